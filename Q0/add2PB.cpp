@@ -1,36 +1,261 @@
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <chrono>
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
 
 using namespace std;
 
+const char* PHONE_BOOK = "phoneBook.txt";  // Phone book shared with findPhone
+const size_t DEFAULT_BATCH_BYTES = 1 << 20;  // Bulk mode flushes about 1 MiB per write
 
-int main(int argc, char* argv[]){
 
-    if(argc < 3){
-        cerr << "Usage :" << argv[0] << "<FullName> <PhoneNumber> \n";
+/**
+ * Open the phone book for appending.
+ * @return The descriptor, or -1 on error.
+ */
+int openPhoneBook(){
+    return open(PHONE_BOOK, O_WRONLY | O_APPEND | O_CREAT, 0644);
+}
+
+
+/**
+ * Append one batch of complete records to the phone book.
+ * The batch is written under an exclusive flock so that records from
+ * concurrent add2PB instances never interleave, even if the kernel
+ * splits the write. O_APPEND puts every batch at the current end of file.
+ * Compaction (pbCompact -l) renames a new file over the phone book while
+ * holding the same lock, so once the lock is ours we make sure fd still
+ * refers to the current file and reopen it if not.
+ * @return True if the whole batch was written.
+ */
+bool appendBatch(int& fd, const string& batch){
+
+    if(batch.empty()){
+        return true;
+    }
+
+    while(true){
+        if(flock(fd, LOCK_EX) == -1){
+            perror("flock");
+            return false;
+        }
+        struct stat locked, current;
+        if(fstat(fd, &locked) == 0 && stat(PHONE_BOOK, &current) == 0 && locked.st_ino == current.st_ino){
+            break;
+        }
+        int fresh = openPhoneBook();
+        if(fresh == -1){
+            perror("open");
+            flock(fd, LOCK_UN);
+            return false;
+        }
+        close(fd);
+        fd = fresh;
+    }
+
+    const char* p = batch.data();
+    size_t left = batch.size();
+    while(left > 0){
+        ssize_t n = write(fd, p, left);
+        if(n < 0){
+            if(errno == EINTR) continue;
+            perror("write");
+            break;
+        }
+        p += n;
+        left -= n;
+    }
+
+    flock(fd, LOCK_UN);
+    return left == 0;
+}
+
+
+/**
+ * Read "name,phone" records (or "name,phone,set" / "name,,del" log
+ * records) from input and append them in large batches.
+ * @param syncEvery Call fdatasync after this many batches (0 = never).
+ * @return Process exit status.
+ */
+int bulkIngest(istream& input, int& fd, size_t batchBytes, unsigned syncEvery){
+
+    auto start = chrono::steady_clock::now();
+
+    string batch;
+    batch.reserve(batchBytes);
+    string line;
+    unsigned long long records = 0, bytes = 0, skipped = 0;
+    unsigned pendingBatches = 0;
+
+    // Flush the buffer and group-commit to disk when due
+    auto flush = [&](bool last) {
+        if(!appendBatch(fd, batch)){
+            return false;
+        }
+        bytes += batch.size();
+        if(!batch.empty()) pendingBatches++;
+        batch.clear();
+
+        if(syncEvery > 0 && pendingBatches > 0 && (last || pendingBatches >= syncEvery)){
+            if(fdatasync(fd) == -1){
+                perror("fdatasync");
+                return false;
+            }
+            pendingBatches = 0;
+        }
+        return true;
+    };
+
+    while(getline(input, line)){
+        if(!line.empty() && line.back() == '\r') line.pop_back();
+        if(line.empty()) continue;
+
+        // Every record needs a name and a phone number
+        if(line.find(',') == string::npos){
+            skipped++;
+            continue;
+        }
+
+        // Records are never split between two batches
+        if(batch.size() + line.size() + 1 > batchBytes && !flush(false)){
+            return 1;
+        }
+        batch += line;
+        batch += '\n';
+        records++;
+    }
+
+    if(!flush(true)){
         return 1;
     }
 
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    if(seconds <= 0) seconds = 1e-9;
+
+    cout << "Ingested " << records << " records (" << bytes << " bytes) in " << seconds << " s: "
+         << (unsigned long long)(records / seconds) << " records/s, "
+         << bytes / seconds / (1 << 20) << " MiB/s" << endl;
+    if(skipped > 0){
+        cerr << "Skipped " << skipped << " malformed lines (expected name,phone)\n";
+    }
+    return 0;
+}
 
-    // Construct the entry as "Full Name, PhoneNumber\n" format
-    string name = argv[1];
-    string phone_number = argv[2];
+
+void usage(const char* prog){
+    cerr << "Usage :" << prog << " <FullName> <PhoneNumber> \n"
+         << "       " << prog << " -u <FullName> <PhoneNumber>   (replace every phone of the name)\n"
+         << "       " << prog << " -d <FullName>                 (delete the name)\n"
+         << "       " << prog << " -b [-s <batchBytes>] [-f <syncEveryBatches>] [file|-]\n";
+}
+
+
+int main(int argc, char* argv[]){
+
+    bool bulk = false;
+    char op = 'a';  // a = add, u = upsert, d = delete
+    size_t batchBytes = DEFAULT_BATCH_BYTES;
+    unsigned syncEvery = 0;
+
+    // Parse command-line options
+    int opt;
+    while((opt = getopt(argc, argv, "bs:f:ud")) != -1){
+        switch(opt){
+            case 'b':
+                bulk = true;
+                break;
+            case 's':
+                batchBytes = strtoull(optarg, nullptr, 10);
+                break;
+            case 'f':
+                syncEvery = strtoul(optarg, nullptr, 10);
+                break;
+            case 'u':
+            case 'd':
+                op = opt;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    int needed = op == 'd' ? 1 : 2;
+    if(bulk ? argc - optind > 1 || op != 'a' : argc - optind < needed){
+        usage(argv[0]);
+        return 1;
+    }
+    if(batchBytes == 0) batchBytes = DEFAULT_BATCH_BYTES;
 
 
     //open the phone book file
-    ofstream phone_book("phoneBook.txt", ios::app);
+    int fd = openPhoneBook();
 
-    if(!phone_book.is_open()){
+    if(fd == -1){
         cerr << "Failed in open phoneBook.txt file";
         return 1;
     }
 
-    //Write the details into the file
-    phone_book << name << "," << phone_number << "\n";
-    phone_book.close();
+    int status = 0;
+    if(bulk){
+        // Records come from the named file, or stdin when none (or "-") is given
+        ios::sync_with_stdio(false);
+        string source = optind < argc ? argv[optind] : "-";
+        if(source == "-"){
+            status = bulkIngest(cin, fd, batchBytes, syncEvery);
+        }
+        else{
+            ifstream input(source);
+            if(!input.is_open()){
+                cerr << "Failed in open " << source << " file\n";
+                close(fd);
+                return 1;
+            }
+            status = bulkIngest(input, fd, batchBytes, syncEvery);
+        }
+    }
+    else if(op != 'a'){
+        // Upserts and deletes are log records that readers apply in order:
+        // "Full Name,PhoneNumber,set" or "Full Name,,del"
+        string name = argv[optind];
+        string phone_number = op == 'u' ? argv[optind + 1] : "";
+        if(name.find(',') != string::npos || phone_number.find(',') != string::npos){
+            cerr << "Names and phone numbers cannot contain ','\n";
+            close(fd);
+            return 1;
+        }
 
-    cout << "Added data :" << name << "," << phone_number << endl;
+        if(!appendBatch(fd, name + "," + phone_number + (op == 'u' ? ",set\n" : ",del\n"))){
+            status = 1;
+        }
+        else if(op == 'u'){
+            cout << "Updated data :" << name << "," << phone_number << endl;
+        }
+        else{
+            cout << "Deleted data :" << name << endl;
+        }
+    }
+    else{
+        // Construct the entry as "Full Name, PhoneNumber\n" format
+        string name = argv[optind];
+        string phone_number = argv[optind + 1];
 
-    return 0;
+        //Write the details into the file
+        if(!appendBatch(fd, name + "," + phone_number + "\n")){
+            status = 1;
+        }
+        else{
+            cout << "Added data :" << name << "," << phone_number << endl;
+        }
+    }
+
+    close(fd);
+    return status;
 }
@@ -4,87 +4,523 @@
 #include <sys/wait.h>
 #include <stdlib.h>
 #include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
-int main(int argc, char *argv[])
+#include "pbFile.h"
+#include "pbIndex.h"
+#include "pbBinary.h"
+#include "pbDaemon.h"
+#include "pbScan.h"
+#include "pbMulti.h"
+#include "pbParallel.h"
+#include "pbPipe.h"
+#include "pbLog.h"
+
+// Phone book searched by every mode (-f overrides it)
+static const char *phoneBook = PHONE_BOOK;
+
+// Worker threads for the scanning modes (-j); 0 streams on the calling thread
+static size_t scanThreads = 0;
+
+// Print the phones a name resolved to after upserts and deletes
+static int printLive(pb_live *live)
 {
-    // Validate the number of arguments
-    if (argc < 2 || argc > 3)
+    for (size_t i = 0; i < live->count; i++)
+    {
+        pb_print_phone(stdout, live->lines[i], live->ends[i]);
+    }
+    int failed = live->failed;
+    pb_live_free(live);
+    if (failed)
+    {
+        fprintf(stderr, "Out of memory, results are incomplete\n");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+// Look up an exact name through the cached name index
+static int runIndexLookup(const char *name)
+{
+    pb_index index;
+    if (pb_index_open(&index, phoneBook) == -1)
     {
-        fprintf(stderr, "Invalid number of arguments. Usage: %s <pattern>\n", argv[0]);
+        perror(phoneBook);
         return EXIT_FAILURE;
     }
 
-    int pipefd[2]; // Pipe file descriptors for communication between processes
+    pb_live live = {0};
+    pb_index_lookup(&index, name, strlen(name), pb_live_apply, &live);
+    int status = printLive(&live);
+    pb_index_close(&index);
+    return status;
+}
 
-    // Create a pipe
-    if (pipe(pipefd) == -1)
+// Print the phone of a record found in the binary phone book
+static void printRecord(const char *name, size_t nameLen, const char *phone, size_t phoneLen, void *arg)
+{
+    fwrite(phone, 1, phoneLen, (FILE *)arg);
+    putc('\n', (FILE *)arg);
+}
+
+// Exact or prefix lookup in the compacted binary phone book
+static int runBinaryLookup(const char *key, int prefix)
+{
+    pb_binary book;
+    if (pb_binary_open(&book, PB_BINARY_FILE) == -1)
     {
-        perror("Pipe creation failed");
+        perror("Opening " PB_BINARY_FILE " failed (build it with pbCompact)");
         return EXIT_FAILURE;
     }
+    if (pb_binary_is_stale(&book, phoneBook))
+    {
+        fprintf(stderr, "Warning: " PB_BINARY_FILE " is older than %s, run pbCompact\n", phoneBook);
+    }
+
+    pb_binary_lookup(&book, key, strlen(key), prefix, printRecord, stdout);
+    pb_binary_close(&book);
+    return EXIT_SUCCESS;
+}
 
-    // Fork for the grep process
-    pid_t grepPid = fork();
-    if (grepPid == 0)
+// Exact name scan over the mapped phone book, used when no daemon is running
+static int runDirectScan(const char *name)
+{
+    pb_map book;
+    if (pb_map_open(&book, phoneBook) == -1)
     {
-        printf("Grep process ID: %d\n", getpid());
-        dup2(pipefd[1], STDOUT_FILENO); // Redirect stdout to pipe
-        close(pipefd[0]); // Close the read end of the pipe
-        close(pipefd[1]); // Close the write end (after duplicating)
-        execlp("grep", "grep", argv[1], "phoneBook.txt", NULL); // Execute grep
-        perror("Grep execution failed");
+        perror(phoneBook);
         return EXIT_FAILURE;
     }
-    else if (grepPid < 0)
+
+    pb_live live = {0};
+    pb_scan_exact(&book, name, strlen(name), pb_live_apply, &live);
+    int status = printLive(&live);
+    pb_map_close(&book);
+    return status;
+}
+
+// Ask the resident pbDaemon for an exact name; scan the file directly
+// when the daemon is not running
+static int runDaemonLookup(const char *name)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, PB_DAEMON_SOCKET, sizeof(addr.sun_path) - 1);
+
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock == -1 || connect(sock, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+    {
+        if (sock != -1)
+        {
+            close(sock);
+        }
+        return runDirectScan(name);
+    }
+
+    // Send the request: the name on one line
+    size_t len = strlen(name);
+    char *request = malloc(len + 1);
+    if (request == NULL)
+    {
+        close(sock);
+        return runDirectScan(name);
+    }
+    memcpy(request, name, len);
+    request[len] = '\n';
+    ssize_t sent = send(sock, request, len + 1, MSG_NOSIGNAL);
+    free(request);
+    if (sent != (ssize_t)(len + 1))
     {
-        perror("Fork for grep failed");
+        close(sock);
+        return runDirectScan(name);
+    }
+
+    // Read the match count, then copy that many phone lines to stdout
+    char buffer[4096];
+    size_t remaining = 0;
+    int inHeader = 1;
+    while (1)
+    {
+        ssize_t n = read(sock, buffer, sizeof(buffer));
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            fprintf(stderr, "Daemon closed the connection early\n");
+            close(sock);
+            return EXIT_FAILURE;
+        }
+
+        ssize_t i = 0;
+        while (inHeader && i < n)
+        {
+            char ch = buffer[i++];
+            if (ch == '\n')
+            {
+                inHeader = 0;
+            }
+            else if (ch >= '0' && ch <= '9')
+            {
+                remaining = remaining * 10 + (size_t)(ch - '0');
+            }
+            else
+            {
+                fprintf(stderr, "Unexpected response from the daemon\n");
+                close(sock);
+                return EXIT_FAILURE;
+            }
+        }
+        ssize_t start = i;
+        while (!inHeader && remaining > 0 && i < n)
+        {
+            remaining -= buffer[i++] == '\n';
+        }
+        fwrite(buffer + start, 1, (size_t)(i - start), stdout);
+        if (!inHeader && remaining == 0)
+        {
+            close(sock);
+            return EXIT_SUCCESS;
+        }
+    }
+}
+
+// Where a scan prints its matches, and what it needs to skip the lines
+// that later upserts or deletes replaced
+typedef struct
+{
+    const pb_scanner *scanner; // -s
+    const pb_multi *automaton; // -m
+    const pb_log_ops *ops;
+    const char *data;          // Buffer being scanned
+    off_t offset;              // Where it starts in the phone book
+    FILE *out;
+} scan_output;
+
+static int isLive(const scan_output *scan, const char *line, const char *end)
+{
+    return pb_log_ops_live(scan->ops, line, end, (unsigned long long)(scan->offset + (line - scan->data)));
+}
+
+// Print the phone of a matched line
+static void printMatch(const char *line, const char *end, void *arg)
+{
+    const scan_output *scan = arg;
+    if (isLive(scan, line, end))
+    {
+        pb_print_phone(scan->out, line, end);
+    }
+}
+
+// Print the phone of a line matched by a batch query, tagged with the query
+static void printTagged(size_t id, const char *line, const char *end, void *arg)
+{
+    const scan_output *scan = arg;
+    if (isLive(scan, line, end))
+    {
+        fputs(scan->automaton->patterns[id], scan->out);
+        putc_unlocked('\t', scan->out);
+        pb_print_phone(scan->out, line, end);
+    }
+}
+
+static size_t scanBuffer(scan_output *scan, const char *data, size_t n)
+{
+    scan->data = data;
+    return scan->scanner != NULL ? pb_scan_buffer(scan->scanner, data, n, printMatch, scan)
+                                 : pb_multi_scan_buffer(scan->automaton, data, n, printTagged, scan);
+}
+
+// pb_stream_chunks hands over the file in order, one run of lines after the other
+static size_t scanChunk(const char *data, size_t n, void *ctx)
+{
+    scan_output *scan = ctx;
+    size_t matches = scanBuffer(scan, data, n);
+    scan->offset += (off_t)n;
+    return matches;
+}
+
+static size_t scanShard(const char *data, size_t n, off_t offset, void *ctx, FILE *out)
+{
+    scan_output scan = *(const scan_output *)ctx;
+    scan.offset = offset;
+    scan.out = out;
+    return scanBuffer(&scan, data, n);
+}
+
+// Stream the phone book through a scan in large chunks, or shard it over
+// scanThreads threads. Only the names of matched lines are checked for later
+// upserts and deletes, so the book is read once and never rewritten
+static int scanBook(const pb_scanner *scanner, const pb_multi *automaton)
+{
+    int fd = open(phoneBook, O_RDONLY);
+    pb_log_ops ops;
+    if (fd == -1 || pb_log_ops_open(&ops, fd, phoneBook) == -1)
+    {
+        perror(phoneBook);
+        if (fd != -1)
+        {
+            close(fd);
+        }
         return EXIT_FAILURE;
     }
 
-    // Fork for the cut process
-    pid_t cutPid = fork();
-    if (cutPid == 0)
+    scan_output scan = {scanner, automaton, &ops, NULL, 0, stdout};
+    long matches = scanThreads > 0 ? pb_parallel_scan(fd, scanThreads, scanShard, &scan, stdout)
+                                   : pb_stream_chunks(fd, scanChunk, &scan);
+    pb_log_ops_close(&ops);
+    close(fd);
+    if (matches < 0)
     {
-        printf("Cut process ID: %d\n", getpid());
-        dup2(pipefd[0], STDIN_FILENO); // Redirect stdin from pipe
-        close(pipefd[0]); // Close the read end (after duplicating)
-        close(pipefd[1]); // Close the write end of the pipe
-        execlp("cut", "cut", "-d,", "-f2", NULL); // Execute cut
-        perror("Cut execution failed");
+        perror(phoneBook);
         return EXIT_FAILURE;
     }
-    else if (cutPid < 0)
+    return EXIT_SUCCESS;
+}
+
+// Fixed-string search with the built-in vectorized scanner, printing the
+// phone field of every live line that matches
+static int runScan(const char *pattern)
+{
+    pb_scanner scanner;
+    pb_scanner_init(&scanner, pattern, strlen(pattern), NULL);
+    return scanBook(&scanner, NULL);
+}
+
+// Read one pattern per line from a file ("-" for stdin)
+static char **readPatterns(const char *source, size_t *count)
+{
+    FILE *in = strcmp(source, "-") == 0 ? stdin : fopen(source, "r");
+    if (in == NULL)
+    {
+        return NULL;
+    }
+
+    char **patterns = NULL;
+    size_t cap = 0;
+    char *line = NULL;
+    size_t lineCap = 0;
+    ssize_t len;
+    *count = 0;
+    while ((len = getline(&line, &lineCap, in)) != -1)
     {
-        perror("Fork for cut failed");
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+        {
+            line[--len] = '\0';
+        }
+        if (len == 0)
+        {
+            continue;
+        }
+        if (*count == cap)
+        {
+            cap = cap > 0 ? cap * 2 : 64;
+            char **grown = realloc(patterns, cap * sizeof(*patterns));
+            if (grown == NULL)
+            {
+                break;
+            }
+            patterns = grown;
+        }
+        patterns[(*count)++] = strdup(line);
+    }
+
+    free(line);
+    if (in != stdin)
+    {
+        fclose(in);
+    }
+    return patterns != NULL ? patterns : calloc(1, sizeof(*patterns));
+}
+
+// Match every pattern listed in source against the phone book in a single
+// pass with an Aho-Corasick automaton; each result line is "<query>\t<phone>"
+static int runBatch(const char *source)
+{
+    size_t count;
+    char **patterns = readPatterns(source, &count);
+    if (patterns == NULL)
+    {
+        perror(source);
         return EXIT_FAILURE;
     }
 
-    // Fork for the sed process
-    pid_t sedPid = fork();
-    if (sedPid == 0)
+    int status = EXIT_FAILURE;
+    pb_multi automaton;
+    if (pb_multi_build(&automaton, patterns, count) == -1)
     {
-        printf("Sed process ID: %d\n", getpid());
-        dup2(pipefd[0], STDIN_FILENO); // Redirect stdin from pipe
-        close(pipefd[0]); // Close the read end of the pipe
-        close(pipefd[1]); // Close the write end of the pipe
-        execlp("sed", "sed", "s/ //g", NULL); // Execute sed
-        perror("Sed execution failed");
+        fprintf(stderr, "Out of memory building the query automaton\n");
+    }
+    else
+    {
+        status = scanBook(NULL, &automaton);
+        pb_multi_free(&automaton);
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        free(patterns[i]);
+    }
+    free(patterns);
+    return status;
+}
+
+// Pipeline stage after `grep -b`: drop the matched lines that later upserts
+// or deletes replaced, and the offsets grep put in front of them
+static int filterLive(void *arg)
+{
+    const pb_log_ops *ops = arg;
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t len;
+    while ((len = getline(&line, &cap, stdin)) != -1)
+    {
+        char *text;
+        unsigned long long offset = strtoull(line, &text, 10);
+        if (*text != ':')
+        {
+            continue;
+        }
+        text++;
+        const char *end = line + len;
+        if (end > text && end[-1] == '\n')
+        {
+            end--;
+        }
+        if (pb_log_ops_live(ops, text, end, offset))
+        {
+            fwrite(text, 1, (size_t)(end - text), stdout);
+            putchar('\n');
+        }
+    }
+    free(line);
+    return EXIT_SUCCESS;
+}
+
+// Search with the grep | cut | sed process pipeline
+static int runPipeline(const char *pattern)
+{
+    // grep pattern | cut -d, -f2 | sed 's/ //g', with the phone book
+    // spliced into grep's stdin. If it holds upserts or deletes, grep also
+    // prints the offset of every match so that filterLive can check it
+    char *grepArgs[] = {"grep", "--", (char *)pattern, NULL};
+    char *offsetArgs[] = {"grep", "-b", "--", (char *)pattern, NULL};
+    char *cutArgs[] = {"cut", "-d,", "-f2", NULL};
+    char *sedArgs[] = {"sed", "s/ //g", NULL};
+
+    int fd = open(phoneBook, O_RDONLY);
+    pb_log_ops ops;
+    if (fd == -1 || pb_log_ops_open(&ops, fd, phoneBook) == -1)
+    {
+        perror(phoneBook);
+        if (fd != -1)
+        {
+            close(fd);
+        }
         return EXIT_FAILURE;
     }
-    else if (sedPid < 0)
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    pb_stage plain[] = {{grepArgs}, {cutArgs}, {sedArgs}};
+    pb_stage filtered[] = {{offsetArgs}, {NULL, filterLive, &ops}, {cutArgs}, {sedArgs}};
+    fflush(stdout); // Keep our buffered output ahead of the filters'
+    int status = ops.names == 0 ? pb_pipeline_run(plain, sizeof(plain) / sizeof(plain[0]), fd, STDOUT_FILENO)
+                                : pb_pipeline_run(filtered, sizeof(filtered) / sizeof(filtered[0]), fd, STDOUT_FILENO);
+    pb_log_ops_close(&ops);
+    close(fd);
+    if (status == -1)
     {
-        perror("Fork for sed failed");
+        perror("Pipeline failed");
         return EXIT_FAILURE;
     }
+    return status == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-f <phoneBook>] [-i | -x | -p | -d | -s [-j <threads>]] <pattern>\n", prog);
+    fprintf(stderr, "       %s [-f <phoneBook>] [-j <threads>] -m <patternFile | ->\n", prog);
+    fprintf(stderr, "  (default) grep | cut | sed process pipeline\n");
+    fprintf(stderr, "  -i  exact name lookup through the cached index\n");
+    fprintf(stderr, "  -x  exact name lookup in " PB_BINARY_FILE "\n");
+    fprintf(stderr, "  -p  name prefix lookup in " PB_BINARY_FILE "\n");
+    fprintf(stderr, "  -d  exact name lookup through pbDaemon (direct scan if it is not running)\n");
+    fprintf(stderr, "  -s  fixed-string search with the built-in SIMD scanner\n");
+    fprintf(stderr, "  -m  match a list of fixed strings (one per line) in a single pass\n");
+    fprintf(stderr, "  -j  scan -s / -m shards on this many threads (0 = number of cores)\n");
+}
+
+int main(int argc, char *argv[])
+{
+    int mode = 0; // Lookup mode option, 0 for the process pipeline
+    const char *batchSource = NULL;
+
+    // Parse command-line options
+    int opt;
+    while ((opt = getopt(argc, argv, "f:ixpdsm:j:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'f':
+            phoneBook = optarg;
+            break;
+        case 'i':
+        case 'x':
+        case 'p':
+        case 'd':
+        case 's':
+            mode = opt;
+            break;
+        case 'j':
+            scanThreads = strtoul(optarg, NULL, 10);
+            if (scanThreads == 0)
+            {
+                long cores = sysconf(_SC_NPROCESSORS_ONLN);
+                scanThreads = cores > 0 ? (size_t)cores : 1;
+            }
+            break;
+        case 'm':
+            mode = opt;
+            batchSource = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
 
-    printf("Parent process ID: %d\n", getpid());
-    close(pipefd[0]); // Close the read end of the pipe
-    close(pipefd[1]); // Close the write end of the pipe
+    // Validate the number of arguments
+    if (argc - optind != (mode == 'm' ? 0 : 1))
+    {
+        fprintf(stderr, "Invalid number of arguments.\n");
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
 
-    // Wait for all child processes to finish
-    waitpid(grepPid, NULL, 0);
-    waitpid(cutPid, NULL, 0);
-    waitpid(sedPid, NULL, 0);
+    if (mode == 'm')
+    {
+        return runBatch(batchSource);
+    }
 
-    return EXIT_SUCCESS;
+    const char *pattern = argv[optind];
+    switch (mode)
+    {
+    case 'i':
+        return runIndexLookup(pattern);
+    case 'x':
+        return runBinaryLookup(pattern, 0);
+    case 'p':
+        return runBinaryLookup(pattern, 1);
+    case 'd':
+        return runDaemonLookup(pattern);
+    case 's':
+        return runScan(pattern);
+    default:
+        return runPipeline(pattern);
+    }
 }
@@ -0,0 +1,335 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "pbFile.h"
+#include "pbBinary.h"
+#include "pbDaemon.h"
+
+#define MAX_ARGS 8
+
+// A lookup engine: the findPhone options that select it
+typedef struct
+{
+    const char *name;
+    const char *args[3]; // Extra findPhone options, NULL terminated
+    int needsBinary;     // Rebuild phoneBook.pbb with pbCompact first
+    int needsDaemon;     // Run pbDaemon while measuring
+} engine;
+
+static const engine ENGINES[] = {
+    {"pipeline", {NULL}, 0, 0},
+    {"scan", {"-s", NULL}, 0, 0},
+    {"parallel", {"-s", "-j0", NULL}, 0, 0},
+    {"index", {"-i", NULL}, 0, 0},
+    {"binary", {"-x", NULL}, 1, 0},
+    {"daemon", {"-d", NULL}, 0, 1},
+};
+
+static const char *binDir = ".."; // Where findPhone, add2PB, pbCompact and pbDaemon live
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void binPath(char *out, size_t len, const char *tool)
+{
+    snprintf(out, len, "%s/%s", binDir, tool);
+}
+
+// Run a tool from binDir with its output discarded; returns once it exits
+static void runTool(const char *tool, char *const args[])
+{
+    char path[4096];
+    binPath(path, sizeof(path), tool);
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        int devnull = open("/dev/null", O_WRONLY);
+        dup2(devnull, STDOUT_FILENO);
+        dup2(devnull, STDERR_FILENO);
+        execv(path, args);
+        _exit(127);
+    }
+    waitpid(pid, NULL, 0);
+}
+
+// Drop the phone book and its derived files from the page cache
+static void evictCaches(void)
+{
+    static const char *FILES[] = {PHONE_BOOK, PHONE_BOOK ".idx", PB_BINARY_FILE};
+    for (size_t i = 0; i < sizeof(FILES) / sizeof(FILES[0]); i++)
+    {
+        int fd = open(FILES[i], O_RDONLY);
+        if (fd != -1)
+        {
+            fdatasync(fd); // Dirty pages cannot be dropped
+            posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+            close(fd);
+        }
+    }
+}
+
+// Take the name of the line that starts after the middle of the phone book
+static char *pickHitName(void)
+{
+    pb_map book;
+    if (pb_map_open(&book, PHONE_BOOK) == -1 || book.size == 0)
+    {
+        return strdup("Tsofia");
+    }
+    const char *end = book.data + book.size;
+    const char *line = pb_line_end(book.data + book.size / 2, end) + 1;
+    if (line >= end)
+    {
+        line = book.data;
+    }
+    char *name = strndup(line, pb_name_len(line, pb_line_end(line, end)));
+    pb_map_close(&book);
+    return name;
+}
+
+// Start add2PB -b fed by a child that keeps writing records until killed.
+// Returns the feeder's pid and sets *writer to add2PB's, which exits once
+// the feeder is gone
+static pid_t startAppender(int id, pid_t *writer)
+{
+    *writer = -1;
+    int pipefd[2];
+    if (pipe(pipefd) == -1)
+    {
+        return -1;
+    }
+
+    char path[4096];
+    binPath(path, sizeof(path), "add2PB");
+    *writer = fork();
+    if (*writer == 0)
+    {
+        dup2(pipefd[0], STDIN_FILENO);
+        close(pipefd[0]);
+        close(pipefd[1]);
+        int devnull = open("/dev/null", O_WRONLY);
+        dup2(devnull, STDOUT_FILENO);
+        execl(path, "add2PB", "-b", "-s", "65536", NULL);
+        _exit(127);
+    }
+
+    pid_t feeder = fork();
+    if (feeder == 0)
+    {
+        close(pipefd[0]);
+        FILE *out = fdopen(pipefd[1], "w");
+        for (unsigned long long i = 0;; i++)
+        {
+            fprintf(out, "Bench Appender%d %llu,050-%07llu\n", id, i, i % 10000000);
+            if (i % 1000 == 999)
+            {
+                fflush(out);
+                usleep(10000); // About 100k records per second per appender
+            }
+        }
+    }
+
+    close(pipefd[0]);
+    close(pipefd[1]);
+    return feeder;
+}
+
+static int compareDoubles(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+// Nearest-rank percentile of sorted samples
+static double percentile(const double *sorted, size_t n, double p)
+{
+    size_t rank = (size_t)(p * n + 0.999999);
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+// Measure one cell of the matrix and append a CSV row. Every cell starts
+// from the same phone book: what the appenders add is cut off afterwards
+static void measure(FILE *csv, const engine *e, int cold, const char *query, const char *queryKind,
+                    int appenders, int runs)
+{
+    char *args[MAX_ARGS];
+    int n = 0;
+    args[n++] = "findPhone";
+    for (int i = 0; e->args[i] != NULL; i++)
+    {
+        args[n++] = (char *)e->args[i];
+    }
+    args[n++] = (char *)query;
+    args[n] = NULL;
+
+    struct stat st;
+    off_t bookSize = stat(PHONE_BOOK, &st) == 0 ? st.st_size : -1;
+
+    // Bring the index file and the daemon up to date with the restored
+    // book, and warm the caches, before anything is timed
+    runTool("findPhone", args);
+
+    pid_t feeders[64], writers[64];
+    for (int a = 0; a < appenders; a++)
+    {
+        feeders[a] = startAppender(a, &writers[a]);
+    }
+
+    double *samples = malloc(runs * sizeof(*samples));
+    for (int r = 0; r < runs; r++)
+    {
+        if (cold)
+        {
+            evictCaches();
+        }
+        double start = now();
+        runTool("findPhone", args);
+        samples[r] = now() - start;
+    }
+
+    for (int a = 0; a < appenders; a++)
+    {
+        if (feeders[a] > 0)
+        {
+            kill(feeders[a], SIGKILL);
+            waitpid(feeders[a], NULL, 0);
+        }
+        if (writers[a] > 0)
+        {
+            waitpid(writers[a], NULL, 0); // Done appending once its input is gone
+        }
+    }
+    if (bookSize >= 0 && truncate(PHONE_BOOK, bookSize) == -1)
+    {
+        perror("Restoring " PHONE_BOOK);
+    }
+
+    qsort(samples, runs, sizeof(*samples), compareDoubles);
+    fprintf(csv, "%s,%s,%s,%d,%d,%.1f,%.1f\n", e->name, cold ? "cold" : "warm", queryKind,
+            appenders, runs, percentile(samples, runs, 0.50) * 1e6,
+            percentile(samples, runs, 0.99) * 1e6);
+    fflush(csv);
+    free(samples);
+}
+
+int main(int argc, char *argv[])
+{
+    int runs = 50;
+    int appenders = 2;
+    const char *output = "results.csv";
+
+    // Parse command-line options
+    int opt;
+    while ((opt = getopt(argc, argv, "b:n:a:o:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'b':
+            binDir = optarg;
+            break;
+        case 'n':
+            runs = atoi(optarg);
+            break;
+        case 'a':
+            appenders = atoi(optarg);
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-b <binDir>] [-n <runs>] [-a <appenders>] [-o <results.csv>]\n"
+                            "Run inside a directory holding the " PHONE_BOOK " to measure\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (runs <= 0 || appenders < 0 || appenders > 64)
+    {
+        fprintf(stderr, "runs must be positive and appenders between 0 and 64\n");
+        return EXIT_FAILURE;
+    }
+
+    FILE *csv = strcmp(output, "-") == 0 ? stdout : fopen(output, "w");
+    if (csv == NULL)
+    {
+        perror(output);
+        return EXIT_FAILURE;
+    }
+    fprintf(csv, "engine,cache,query,appenders,runs,p50_us,p99_us\n");
+
+    char *hit = pickHitName();
+    const char *miss = "Nobody Here";
+    int appenderCounts[2] = {0, appenders};
+
+    for (size_t i = 0; i < sizeof(ENGINES) / sizeof(ENGINES[0]); i++)
+    {
+        const engine *e = &ENGINES[i];
+        fprintf(stderr, "Measuring %s...\n", e->name);
+
+        if (e->needsBinary)
+        {
+            char *args[] = {"pbCompact", NULL};
+            runTool("pbCompact", args);
+        }
+
+        pid_t daemon = -1;
+        if (e->needsDaemon)
+        {
+            char path[4096];
+            binPath(path, sizeof(path), "pbDaemon");
+            daemon = fork();
+            if (daemon == 0)
+            {
+                int devnull = open("/dev/null", O_WRONLY);
+                dup2(devnull, STDOUT_FILENO);
+                execl(path, "pbDaemon", NULL);
+                _exit(127);
+            }
+            // Wait until it accepts lookups
+            for (int tries = 0; tries < 600 && access(PB_DAEMON_SOCKET, F_OK) != 0; tries++)
+            {
+                usleep(100000);
+            }
+        }
+
+        for (int a = 0; a < 2; a++)
+        {
+            if (a == 1 && appenders == 0)
+            {
+                continue;
+            }
+            for (int cold = 0; cold < 2; cold++)
+            {
+                measure(csv, e, cold, hit, "hit", appenderCounts[a], runs);
+                measure(csv, e, cold, miss, "miss", appenderCounts[a], runs);
+            }
+        }
+
+        if (daemon > 0)
+        {
+            kill(daemon, SIGTERM);
+            waitpid(daemon, NULL, 0);
+        }
+    }
+
+    free(hit);
+    if (csv != stdout)
+    {
+        fclose(csv);
+    }
+    fprintf(stderr, "Results written to %s\n", output);
+    return EXIT_SUCCESS;
+}
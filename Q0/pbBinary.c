@@ -0,0 +1,345 @@
+#include "pbBinary.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define PB_BINARY_MAGIC "PBBIN01"
+
+// Symbols a packed phone can hold, indexed by nibble value
+static const char PHONE_ALPHABET[16] = "0123456789+-()./";
+
+// Decoding position inside one block
+typedef struct
+{
+    const unsigned char *p;
+    const unsigned char *end;
+    size_t left;                // Records left in the block
+    char name[PB_NAME_MAX];     // Current (reconstructed) name
+    size_t name_len;
+    const unsigned char *phone; // Current packed phone
+} pb_cursor;
+
+static int read_varint(const unsigned char **p, const unsigned char *end, unsigned long long *value)
+{
+    unsigned long long v = 0;
+    for (int shift = 0; shift < 64 && *p < end; shift += 7)
+    {
+        unsigned char byte = *(*p)++;
+        v |= (unsigned long long)(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0)
+        {
+            *value = v;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static void write_varint(FILE *out, unsigned long long value)
+{
+    while (value >= 0x80)
+    {
+        putc_unlocked((int)(value & 0x7f) | 0x80, out);
+        value >>= 7;
+    }
+    putc_unlocked((int)value, out);
+}
+
+// Byte-wise comparison of two names, shorter first on a common prefix
+static int compare_names(const char *a, size_t alen, const char *b, size_t blen)
+{
+    int c = memcmp(a, b, alen < blen ? alen : blen);
+    if (c != 0)
+    {
+        return c;
+    }
+    return alen < blen ? -1 : alen > blen;
+}
+
+// Position a cursor at the start of block b
+static void open_block(const pb_binary *bin, pb_cursor *cur, unsigned long long b)
+{
+    const pb_binary_header *h = bin->header;
+    cur->p = (const unsigned char *)bin->map.data + bin->index[b];
+    cur->end = (const unsigned char *)bin->map.data + h->index_offset;
+    cur->left = b + 1 < h->block_count ? h->block_records
+                                       : h->record_count - b * h->block_records;
+    cur->name_len = 0;
+}
+
+// Decode the next record. Returns 1 on success, 0 at the end of the block, -1 if corrupt
+static int next_record(pb_cursor *cur)
+{
+    if (cur->left == 0)
+    {
+        return 0;
+    }
+
+    unsigned long long shared, suffix;
+    if (read_varint(&cur->p, cur->end, &shared) == -1 ||
+        read_varint(&cur->p, cur->end, &suffix) == -1 ||
+        shared > cur->name_len || shared + suffix > PB_NAME_MAX ||
+        (size_t)(cur->end - cur->p) < suffix + PB_PHONE_WIDTH)
+    {
+        return -1;
+    }
+
+    memcpy(cur->name + shared, cur->p, suffix);
+    cur->name_len = shared + suffix;
+    cur->p += suffix;
+    cur->phone = cur->p;
+    cur->p += PB_PHONE_WIDTH;
+    cur->left--;
+    return 1;
+}
+
+int pb_binary_open(pb_binary *bin, const char *path)
+{
+    memset(bin, 0, sizeof(*bin));
+    if (pb_map_open(&bin->map, path) == -1)
+    {
+        return -1;
+    }
+
+    const pb_binary_header *h = (const pb_binary_header *)bin->map.data;
+    if (bin->map.size < sizeof(*h) ||
+        memcmp(h->magic, PB_BINARY_MAGIC, sizeof(h->magic)) != 0 ||
+        h->block_records != PB_BLOCK_RECORDS || h->phone_width != PB_PHONE_WIDTH ||
+        h->index_offset % sizeof(unsigned long long) != 0 ||
+        h->index_offset > bin->map.size ||
+        (bin->map.size - h->index_offset) / sizeof(unsigned long long) < h->block_count ||
+        h->block_count != (h->record_count + PB_BLOCK_RECORDS - 1) / PB_BLOCK_RECORDS)
+    {
+        pb_map_close(&bin->map);
+        errno = EINVAL;
+        return -1;
+    }
+
+    bin->header = h;
+    bin->index = (const unsigned long long *)(bin->map.data + h->index_offset);
+    for (unsigned long long b = 0; b < h->block_count; b++)
+    {
+        if (bin->index[b] < sizeof(*h) || bin->index[b] >= h->index_offset)
+        {
+            pb_map_close(&bin->map);
+            errno = EINVAL;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void pb_binary_close(pb_binary *bin)
+{
+    pb_map_close(&bin->map);
+    memset(bin, 0, sizeof(*bin));
+}
+
+int pb_binary_is_stale(const pb_binary *bin, const char *source_path)
+{
+    struct stat st;
+    if (stat(source_path, &st) == -1)
+    {
+        return 0; // No text file to be stale against
+    }
+    return (unsigned long long)st.st_size != bin->header->source_size ||
+           (unsigned long long)st.st_mtim.tv_sec != bin->header->source_mtime_sec ||
+           (unsigned long long)st.st_mtim.tv_nsec != bin->header->source_mtime_nsec;
+}
+
+size_t pb_binary_lookup(const pb_binary *bin, const char *key, size_t len, int prefix,
+                        pb_record_fn fn, void *arg)
+{
+    const pb_binary_header *h = bin->header;
+    pb_cursor cur;
+
+    // Find the last block whose first name sorts before the key; equal
+    // names may start at the tail of that block
+    unsigned long long lo = 0;
+    unsigned long long hi = h->block_count;
+    while (lo < hi)
+    {
+        unsigned long long mid = lo + (hi - lo) / 2;
+        open_block(bin, &cur, mid);
+        if (next_record(&cur) != 1)
+        {
+            return 0;
+        }
+        if (compare_names(cur.name, cur.name_len, key, len) < 0)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    size_t found = 0;
+    for (unsigned long long b = lo > 0 ? lo - 1 : 0; b < h->block_count; b++)
+    {
+        open_block(bin, &cur, b);
+        int rc;
+        while ((rc = next_record(&cur)) == 1)
+        {
+            int c = compare_names(cur.name, cur.name_len, key, len);
+            if (c < 0)
+            {
+                continue;
+            }
+
+            int match = prefix ? cur.name_len >= len && memcmp(cur.name, key, len) == 0 : c == 0;
+            if (!match)
+            {
+                return found; // Sorted order: nothing further can match
+            }
+
+            char phone[PB_PHONE_MAX];
+            size_t phone_len = pb_unpack_phone(phone, cur.phone);
+            fn(cur.name, cur.name_len, phone, phone_len, arg);
+            found++;
+        }
+        if (rc == -1)
+        {
+            break;
+        }
+    }
+    return found;
+}
+
+int pb_pack_phone(unsigned char out[PB_PHONE_WIDTH], const char *phone, size_t len)
+{
+    size_t n = 0;
+    memset(out, 0, PB_PHONE_WIDTH);
+    for (size_t i = 0; i < len; i++)
+    {
+        if (phone[i] == ' ')
+        {
+            continue;
+        }
+
+        const char *symbol = phone[i] != '\0' ? memchr(PHONE_ALPHABET, phone[i], sizeof(PHONE_ALPHABET)) : NULL;
+        if (symbol == NULL || n == PB_PHONE_MAX)
+        {
+            return -1;
+        }
+
+        unsigned char nibble = (unsigned char)(symbol - PHONE_ALPHABET);
+        out[1 + n / 2] |= n % 2 == 0 ? nibble << 4 : nibble;
+        n++;
+    }
+    out[0] = (unsigned char)n;
+    return 0;
+}
+
+size_t pb_unpack_phone(char *out, const unsigned char packed[PB_PHONE_WIDTH])
+{
+    size_t len = packed[0] <= PB_PHONE_MAX ? packed[0] : PB_PHONE_MAX;
+    for (size_t n = 0; n < len; n++)
+    {
+        unsigned char byte = packed[1 + n / 2];
+        out[n] = PHONE_ALPHABET[n % 2 == 0 ? byte >> 4 : byte & 0x0f];
+    }
+    return len;
+}
+
+int pb_binary_write(const char *path, const pb_record *records, size_t count, const struct stat *source)
+{
+    size_t tmp_len = strlen(path) + sizeof(".XXXXXX");
+    char *tmp_path = malloc(tmp_len);
+    unsigned long long block_count = (count + PB_BLOCK_RECORDS - 1) / PB_BLOCK_RECORDS;
+    unsigned long long *index = malloc((block_count + 1) * sizeof(*index));
+    if (tmp_path == NULL || index == NULL)
+    {
+        free(tmp_path);
+        free(index);
+        errno = ENOMEM;
+        return -1;
+    }
+    snprintf(tmp_path, tmp_len, "%s.XXXXXX", path);
+
+    int fd = mkstemp(tmp_path);
+    FILE *out = fd != -1 ? fdopen(fd, "wb") : NULL;
+    if (out == NULL)
+    {
+        if (fd != -1)
+        {
+            close(fd);
+            unlink(tmp_path);
+        }
+        free(tmp_path);
+        free(index);
+        return -1;
+    }
+    fchmod(fd, 0644); // mkstemp creates the file owner-only
+
+    // Leave room for the header, written last
+    pb_binary_header header;
+    memset(&header, 0, sizeof(header));
+    fwrite(&header, sizeof(header), 1, out);
+
+    unsigned long long offset = sizeof(header);
+    unsigned long long b = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        const pb_record *r = &records[i];
+        size_t shared = 0;
+
+        if (i % PB_BLOCK_RECORDS == 0)
+        {
+            index[b++] = offset; // Restart point: store the full name
+        }
+        else
+        {
+            const pb_record *prev = &records[i - 1];
+            size_t max = prev->name_len < r->name_len ? prev->name_len : r->name_len;
+            while (shared < max && prev->name[shared] == r->name[shared])
+            {
+                shared++;
+            }
+        }
+
+        long before = ftell(out);
+        write_varint(out, shared);
+        write_varint(out, r->name_len - shared);
+        fwrite(r->name + shared, 1, r->name_len - shared, out);
+        fwrite(r->phone, 1, PB_PHONE_WIDTH, out);
+        offset += (unsigned long long)(ftell(out) - before);
+    }
+
+    // Align the block index
+    while (offset % sizeof(unsigned long long) != 0)
+    {
+        putc_unlocked(0, out);
+        offset++;
+    }
+    fwrite(index, sizeof(*index), block_count, out);
+
+    memcpy(header.magic, PB_BINARY_MAGIC, sizeof(header.magic));
+    header.source_size = source->st_size;
+    header.source_mtime_sec = source->st_mtim.tv_sec;
+    header.source_mtime_nsec = source->st_mtim.tv_nsec;
+    header.record_count = count;
+    header.block_count = block_count;
+    header.index_offset = offset;
+    header.block_records = PB_BLOCK_RECORDS;
+    header.phone_width = PB_PHONE_WIDTH;
+
+    int ok = fseek(out, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, out) == 1 &&
+             fflush(out) == 0 && fsync(fd) == 0;
+    ok = fclose(out) == 0 && ok;
+    if (!ok || rename(tmp_path, path) == -1)
+    {
+        unlink(tmp_path);
+        free(tmp_path);
+        free(index);
+        return -1;
+    }
+
+    free(tmp_path);
+    free(index);
+    return 0;
+}
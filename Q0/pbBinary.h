@@ -0,0 +1,82 @@
+#ifndef PB_BINARY_H
+#define PB_BINARY_H
+
+#include "pbFile.h"
+
+// Default binary phone book built by pbCompact
+#define PB_BINARY_FILE "phoneBook.pbb"
+
+#define PB_PHONE_WIDTH 12   // Fixed width of a packed phone: length byte + 22 nibbles
+#define PB_PHONE_MAX 22     // Longest phone (after removing spaces) that fits
+#define PB_BLOCK_RECORDS 16 // Records per front-coded block
+#define PB_NAME_MAX 1024    // Longest name the format accepts
+
+// File layout:
+//   header | blocks | padding to 8 bytes | block index (u64 offset per block)
+// A block holds up to PB_BLOCK_RECORDS records sorted by name, each stored as
+//   varint shared | varint suffix_len | suffix bytes | phone[PB_PHONE_WIDTH]
+// where `shared` is the prefix length common with the previous name.
+// Phones are normalized (spaces removed) and packed two symbols per byte
+// from the alphabet "0123456789+-()./" after a one-byte length.
+// The first record of every block has shared == 0, so a block can be
+// decoded on its own and its first name serves as the sparse index key.
+typedef struct
+{
+    char magic[8];
+    unsigned long long source_size;       // Size of the text file it was built from
+    unsigned long long source_mtime_sec;  // Modification time of that file
+    unsigned long long source_mtime_nsec;
+    unsigned long long record_count;
+    unsigned long long block_count;
+    unsigned long long index_offset;      // File offset of the block index
+    unsigned int block_records;           // PB_BLOCK_RECORDS at build time
+    unsigned int phone_width;             // PB_PHONE_WIDTH at build time
+} pb_binary_header;
+
+// A binary phone book opened through mmap
+typedef struct
+{
+    pb_map map;
+    const pb_binary_header *header;
+    const unsigned long long *index; // Offset of every block
+} pb_binary;
+
+// One record handed to pb_binary_write
+typedef struct
+{
+    const char *name;
+    size_t name_len;
+    unsigned char phone[PB_PHONE_WIDTH]; // Packed normalized phone
+    unsigned long long seq;              // Position in the source, keeps equal names stable
+} pb_record;
+
+// Called for every record found by a lookup
+typedef void (*pb_record_fn)(const char *name, size_t name_len, const char *phone, size_t phone_len, void *arg);
+
+// Open and validate a binary phone book. Returns 0 on success, -1 on error
+int pb_binary_open(pb_binary *bin, const char *path);
+
+// Release a binary phone book
+void pb_binary_close(pb_binary *bin);
+
+// Return 1 if the text phone book changed since the binary file was built
+int pb_binary_is_stale(const pb_binary *bin, const char *source_path);
+
+// Call fn for every record whose name equals key (prefix == 0) or starts
+// with key (prefix != 0), in name order. Returns the number of records found
+size_t pb_binary_lookup(const pb_binary *bin, const char *key, size_t len, int prefix,
+                        pb_record_fn fn, void *arg);
+
+// Normalize a phone (spaces removed) and pack it into a fixed-width field.
+// Returns 0 on success, -1 if it is too long or uses other characters
+int pb_pack_phone(unsigned char out[PB_PHONE_WIDTH], const char *phone, size_t len);
+
+// Unpack a phone into out (at least PB_PHONE_MAX bytes). Returns its length
+size_t pb_unpack_phone(char *out, const unsigned char packed[PB_PHONE_WIDTH]);
+
+// Write records already sorted by (name, seq) to path, replacing it atomically.
+// source describes the text file the records came from.
+// Returns 0 on success, -1 on error
+int pb_binary_write(const char *path, const pb_record *records, size_t count, const struct stat *source);
+
+#endif
@@ -0,0 +1,207 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "pbFile.h"
+#include "pbBinary.h"
+#include "pbLog.h"
+
+// Order records by name, then by their position in the text file
+static int compareRecords(const void *a, const void *b)
+{
+    const pb_record *x = a;
+    const pb_record *y = b;
+    size_t len = x->name_len < y->name_len ? x->name_len : y->name_len;
+    int c = memcmp(x->name, y->name, len);
+    if (c != 0)
+    {
+        return c;
+    }
+    if (x->name_len != y->name_len)
+    {
+        return x->name_len < y->name_len ? -1 : 1;
+    }
+    return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+// Drop records that repeat an earlier (name, phone) pair. Returns the new count
+static size_t removeDuplicates(pb_record *records, size_t count)
+{
+    size_t kept = 0;
+    size_t group = 0; // First kept record with the current name
+    for (size_t i = 0; i < count; i++)
+    {
+        if (kept == 0 || records[group].name_len != records[i].name_len ||
+            memcmp(records[group].name, records[i].name, records[i].name_len) != 0)
+        {
+            group = kept;
+        }
+        else
+        {
+            int seen = 0;
+            for (size_t j = group; j < kept && !seen; j++)
+            {
+                seen = memcmp(records[j].phone, records[i].phone, PB_PHONE_WIDTH) == 0;
+            }
+            if (seen)
+            {
+                continue;
+            }
+        }
+        records[kept++] = records[i];
+    }
+    return kept;
+}
+
+// Records gathered from the live lines of the text file
+typedef struct
+{
+    pb_record *records;
+    size_t count;
+    size_t skipped;
+    unsigned long long seq;
+} collector;
+
+static void collectRecord(const char *line, const char *eol, void *arg)
+{
+    collector *c = arg;
+    size_t name_len = pb_name_len(line, eol);
+    unsigned long long seq = c->seq++;
+
+    if (line + name_len == eol || name_len > PB_NAME_MAX)
+    {
+        c->skipped++; // No phone field, or a name the format cannot hold
+        return;
+    }
+
+    // The phone is the second comma-separated field, as `cut -f2` sees it
+    const char *phone = line + name_len + 1;
+    const char *comma = memchr(phone, ',', (size_t)(eol - phone));
+    const char *phone_end = comma != NULL ? comma : eol;
+
+    pb_record *r = &c->records[c->count];
+    if (pb_pack_phone(r->phone, phone, (size_t)(phone_end - phone)) == -1)
+    {
+        c->skipped++;
+        return;
+    }
+    r->name = line;
+    r->name_len = name_len;
+    r->seq = seq;
+    c->count++;
+}
+
+// Rewrite the text log in place with only its live records
+static int compactLog(const char *path, double threshold)
+{
+    pb_log_stats stats;
+    int result = pb_log_compact(path, threshold, &stats);
+    if (result == -1)
+    {
+        perror(path);
+        return EXIT_FAILURE;
+    }
+    printf("%s: %zu records, %zu dead: %s\n", path, stats.records, stats.records - stats.live,
+           result == 1 ? "compacted" : "left as is");
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *output = PB_BINARY_FILE;
+    int logOnly = 0;
+    double threshold = 0;
+
+    // Parse command-line options
+    int opt;
+    while ((opt = getopt(argc, argv, "o:lt:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'o':
+            output = optarg;
+            break;
+        case 'l':
+            logOnly = 1;
+            break;
+        case 't':
+            threshold = strtod(optarg, NULL);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-o <output.pbb>] [phoneBook.txt]\n", argv[0]);
+            fprintf(stderr, "       %s -l [-t <deadRatio>] [phoneBook.txt]\n", argv[0]);
+            fprintf(stderr, "  -l  rewrite the text log without superseded and deleted records\n");
+            fprintf(stderr, "  -t  only when at least this share of records is dead (default 0: always)\n");
+            return EXIT_FAILURE;
+        }
+    }
+    const char *input = optind < argc ? argv[optind] : PHONE_BOOK;
+
+    if (logOnly)
+    {
+        return compactLog(input, threshold);
+    }
+
+    pb_map text;
+    if (pb_map_open(&text, input) == -1)
+    {
+        perror(input);
+        return EXIT_FAILURE;
+    }
+
+    // Every line can hold at most one record
+    const char *end = text.data + text.size;
+    size_t lines = 0;
+    for (const char *q = text.data; q < end; q = pb_line_end(q, end) + 1)
+    {
+        lines++;
+    }
+
+    collector c = {malloc((lines + 1) * sizeof(pb_record)), 0, 0, 0};
+    if (c.records == NULL)
+    {
+        perror("malloc");
+        pb_map_close(&text);
+        return EXIT_FAILURE;
+    }
+
+    // Only the records still live after upserts and deletes are kept
+    pb_log_stats stats;
+    if (pb_log_resolve(&text, collectRecord, &c, &stats) == -1)
+    {
+        perror(input);
+        free(c.records);
+        pb_map_close(&text);
+        return EXIT_FAILURE;
+    }
+    pb_record *records = c.records;
+    size_t count = c.count, skipped = c.skipped;
+
+    qsort(records, count, sizeof(*records), compareRecords);
+    size_t kept = removeDuplicates(records, count);
+
+    int status = EXIT_SUCCESS;
+    if (pb_binary_write(output, records, kept, &text.st) == -1)
+    {
+        perror(output);
+        status = EXIT_FAILURE;
+    }
+    else
+    {
+        struct stat st;
+        stat(output, &st);
+        printf("Compacted %zu records into %zu (%zu superseded or deleted, %zu duplicates dropped): "
+               "%zu bytes -> %lld bytes\n",
+               stats.records, kept, stats.records - stats.live, count - kept, text.size, (long long)st.st_size);
+    }
+    if (skipped > 0)
+    {
+        fprintf(stderr, "Skipped %zu malformed lines\n", skipped);
+    }
+
+    free(records);
+    pb_map_close(&text);
+    return status;
+}
@@ -0,0 +1,657 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/inotify.h>
+#include <sys/wait.h>
+
+#include "pbFile.h"
+#include "pbDaemon.h"
+#include "pbLog.h"
+
+#define READ_CHUNK (1 << 20)          // Bytes read from the phone book at a time
+#define CLIENT_OUT_HIGH (4 << 20)     // Stop reading a client with this much unsent output
+#define RESCAN_MS 1000                // Check for appends at least this often
+#define COMPACT_MIN_RECORDS 4096      // Never compact a phone book smaller than this
+#define MAX_REQUEST 4096              // Longest request line; a client sending more is dropped
+
+// One record of the in-memory phone book; strings live in the arena
+typedef struct
+{
+    size_t name;       // Arena offset of the name
+    size_t name_len;
+    size_t phone;      // Arena offset of the formatted phone
+    size_t phone_len;
+    long next;         // Previous record in the same hash bucket, or -1
+    int removed;       // Superseded by an upsert or delete
+} entry;
+
+// Phone book indexed by name, fed incrementally from the text file
+typedef struct
+{
+    char *arena;
+    size_t arena_len, arena_cap;
+    entry *entries;
+    size_t count, cap;
+    long *buckets;         // Newest record of every bucket, or -1
+    size_t nbuckets;       // Power of two
+    size_t records;        // Log lines read, tombstones included
+    size_t dead;           // Lines no longer visible (removed records and tombstones)
+
+    int fd;                // Open phone book, -1 when not loaded
+    ino_t ino;             // Inode of the open phone book
+    off_t offset;          // Bytes consumed so far (always at a line boundary)
+    char *chunk;           // Read buffer
+    size_t chunk_cap;
+} book;
+
+// A connected client with its pending input and output
+typedef struct
+{
+    int fd;
+    char *in;
+    size_t in_len, in_cap;
+    char *out;
+    size_t out_len, out_off, out_cap;
+    int eof;           // Peer finished sending; drop once the output is flushed
+} client;
+
+static volatile sig_atomic_t stopping = 0;
+
+static void onSignal(int sig)
+{
+    (void)sig;
+    stopping = 1;
+}
+
+// Grow *buf so it can hold need bytes
+static int reserve(char **buf, size_t *cap, size_t need)
+{
+    if (need <= *cap)
+    {
+        return 0;
+    }
+    size_t cap2 = *cap > 0 ? *cap : 4096;
+    while (cap2 < need)
+    {
+        cap2 *= 2;
+    }
+    char *p = realloc(*buf, cap2);
+    if (p == NULL)
+    {
+        return -1;
+    }
+    *buf = p;
+    *cap = cap2;
+    return 0;
+}
+
+// Forget every record (used when the file is replaced or truncated)
+static void bookReset(book *b)
+{
+    b->arena_len = 0;
+    b->count = 0;
+    b->records = 0;
+    b->dead = 0;
+    for (size_t i = 0; i < b->nbuckets; i++)
+    {
+        b->buckets[i] = -1;
+    }
+}
+
+// Double the bucket array and relink all records
+static int bookRehash(book *b)
+{
+    size_t n = b->nbuckets > 0 ? b->nbuckets * 2 : 1024;
+    long *buckets = malloc(n * sizeof(*buckets));
+    if (buckets == NULL)
+    {
+        return -1;
+    }
+    for (size_t i = 0; i < n; i++)
+    {
+        buckets[i] = -1;
+    }
+    // Relinking oldest first keeps every chain newest-first
+    for (size_t i = 0; i < b->count; i++)
+    {
+        entry *e = &b->entries[i];
+        if (e->removed)
+        {
+            continue;
+        }
+        size_t slot = pb_hash(b->arena + e->name, e->name_len) & (n - 1);
+        e->next = buckets[slot];
+        buckets[slot] = (long)i;
+    }
+    free(b->buckets);
+    b->buckets = buckets;
+    b->nbuckets = n;
+    return 0;
+}
+
+// Unlink every record of a name, as an upsert or delete requires
+static void bookRemove(book *b, const char *name, size_t len)
+{
+    size_t slot = pb_hash(name, len) & (b->nbuckets - 1);
+    for (long *link = &b->buckets[slot]; *link != -1;)
+    {
+        entry *e = &b->entries[*link];
+        if (e->name_len == len && memcmp(b->arena + e->name, name, len) == 0)
+        {
+            e->removed = 1;
+            *link = e->next;
+            b->dead++;
+        }
+        else
+        {
+            link = &e->next;
+        }
+    }
+}
+
+// Apply one line of the phone book log
+static int bookAdd(book *b, const char *line, const char *eol)
+{
+    size_t name_len = pb_name_len(line, eol);
+    size_t line_len = (size_t)(eol - line);
+
+    pb_op op = pb_line_op(line, eol);
+    b->records++;
+    if (op != PB_OP_ADD)
+    {
+        bookRemove(b, line, name_len);
+    }
+    if (op == PB_OP_DEL)
+    {
+        b->dead++; // The tombstone itself
+        return 0;
+    }
+
+    if (b->count == b->cap)
+    {
+        size_t cap = b->cap > 0 ? b->cap * 2 : 1024;
+        entry *entries = realloc(b->entries, cap * sizeof(*entries));
+        if (entries == NULL)
+        {
+            return -1;
+        }
+        b->entries = entries;
+        b->cap = cap;
+    }
+    if (b->count >= b->nbuckets && bookRehash(b) == -1)
+    {
+        return -1;
+    }
+    if (reserve(&b->arena, &b->arena_cap, b->arena_len + name_len + line_len) == -1)
+    {
+        return -1;
+    }
+
+    entry *e = &b->entries[b->count];
+    e->name = b->arena_len;
+    e->name_len = name_len;
+    memcpy(b->arena + b->arena_len, line, name_len);
+    b->arena_len += name_len;
+    e->phone = b->arena_len;
+    e->phone_len = pb_format_phone(b->arena + b->arena_len, line, eol);
+    b->arena_len += e->phone_len;
+    e->removed = 0;
+
+    size_t slot = pb_hash(line, name_len) & (b->nbuckets - 1);
+    e->next = b->buckets[slot];
+    b->buckets[slot] = (long)b->count;
+    b->count++;
+    return 0;
+}
+
+// Bring the index up to date with the file: reload it from scratch if it
+// was replaced or truncated, otherwise index only the complete lines
+// appended since the last call. Returns the number of lines added
+static long bookRefresh(book *b, const char *path)
+{
+    struct stat st;
+    if (stat(path, &st) == -1)
+    {
+        return 0; // Keep serving the last contents until the file comes back
+    }
+
+    if (b->fd == -1 || st.st_ino != b->ino || st.st_size < b->offset)
+    {
+        int fd = open(path, O_RDONLY);
+        if (fd == -1)
+        {
+            return 0;
+        }
+        if (b->fd != -1)
+        {
+            close(b->fd);
+        }
+        fstat(fd, &st);
+        b->fd = fd;
+        b->ino = st.st_ino;
+        b->offset = 0;
+        bookReset(b);
+    }
+
+    long added = 0;
+    while (1)
+    {
+        ssize_t n = pread(b->fd, b->chunk, b->chunk_cap, b->offset);
+        if (n <= 0)
+        {
+            break;
+        }
+
+        // Only complete lines are indexed; a partial tail is read again later
+        const char *last = memrchr(b->chunk, '\n', (size_t)n);
+        if (last == NULL)
+        {
+            if ((size_t)n < b->chunk_cap || reserve(&b->chunk, &b->chunk_cap, b->chunk_cap * 2) == -1)
+            {
+                break;
+            }
+            continue; // One line longer than the buffer
+        }
+
+        const char *p = b->chunk;
+        while (p < last)
+        {
+            const char *eol = pb_line_end(p, last);
+            if (eol > p && bookAdd(b, p, eol) == -1)
+            {
+                perror("pbDaemon: out of memory");
+                return added;
+            }
+            added += eol > p;
+            p = eol + 1;
+        }
+        b->offset += last + 1 - b->chunk;
+    }
+    return added;
+}
+
+// Append the response for one request to the client's output
+static int answer(client *c, const book *b, const char *name, size_t len)
+{
+    // Chains are newest-first: count and size every match, then fill the
+    // response from its end so that the phones come out in file order
+    size_t slot = pb_hash(name, len) & (b->nbuckets - 1);
+    long first = b->nbuckets > 0 ? b->buckets[slot] : -1;
+    size_t matches = 0, size = 0;
+
+    for (long i = first; i != -1; i = b->entries[i].next)
+    {
+        const entry *e = &b->entries[i];
+        if (e->name_len == len && memcmp(b->arena + e->name, name, len) == 0)
+        {
+            matches++;
+            size += e->phone_len + 1;
+        }
+    }
+    char header[32];
+    size_t header_len = (size_t)snprintf(header, sizeof(header), "%zu\n", matches);
+    if (reserve(&c->out, &c->out_cap, c->out_len + header_len + size) == -1)
+    {
+        return -1;
+    }
+
+    memcpy(c->out + c->out_len, header, header_len);
+    char *p = c->out + c->out_len + header_len + size;
+    for (long i = first; i != -1; i = b->entries[i].next)
+    {
+        const entry *e = &b->entries[i];
+        if (e->name_len == len && memcmp(b->arena + e->name, name, len) == 0)
+        {
+            *--p = '\n';
+            p -= e->phone_len;
+            memcpy(p, b->arena + e->phone, e->phone_len);
+        }
+    }
+    c->out_len += header_len + size;
+    return 0;
+}
+
+// Read whatever the client sent and answer every complete request.
+// Returns -1 when the client should be dropped
+static int serveInput(client *c, const book *b)
+{
+    while (!c->eof)
+    {
+        if (reserve(&c->in, &c->in_cap, c->in_len + 4096) == -1)
+        {
+            return -1;
+        }
+        ssize_t n = read(c->fd, c->in + c->in_len, c->in_cap - c->in_len);
+        if (n == 0)
+        {
+            c->eof = 1; // Still answer what was pipelined before the shutdown
+            break;
+        }
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                break;
+            }
+            return -1;
+        }
+        c->in_len += (size_t)n;
+        if ((size_t)n < 4096 || c->in_len > MAX_REQUEST)
+        {
+            break; // poll() reports the rest once these requests are answered
+        }
+    }
+
+    // Every complete line is one request
+    char *p = c->in;
+    char *end = c->in + c->in_len;
+    char *nl;
+    while ((nl = memchr(p, '\n', (size_t)(end - p))) != NULL)
+    {
+        size_t len = (size_t)(nl - p);
+        if (len > 0 && p[len - 1] == '\r')
+        {
+            len--;
+        }
+        if (answer(c, b, p, len) == -1)
+        {
+            return -1;
+        }
+        p = nl + 1;
+    }
+    c->in_len = (size_t)(end - p);
+    memmove(c->in, p, c->in_len);
+
+    // What is left has no newline yet; past MAX_REQUEST it is not a name
+    if (c->in_len > MAX_REQUEST)
+    {
+        fprintf(stderr, "pbDaemon: dropping a client whose request exceeds %d bytes\n", MAX_REQUEST);
+        return -1;
+    }
+    return 0;
+}
+
+// Send as much pending output as the socket takes. Returns -1 on error
+static int flushOutput(client *c)
+{
+    while (c->out_off < c->out_len)
+    {
+        ssize_t n = write(c->fd, c->out + c->out_off, c->out_len - c->out_off);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+        }
+        c->out_off += (size_t)n;
+    }
+    c->out_off = c->out_len = 0;
+    return 0;
+}
+
+static void dropClient(client *c)
+{
+    close(c->fd);
+    free(c->in);
+    free(c->out);
+}
+
+// Rewrite the phone book without its dead records in a child process once
+// they pass the threshold. The rename shows up as a replaced file, which
+// makes bookRefresh reload it. Returns the child's pid, or -1 if none started
+static pid_t startCompaction(const book *b, const char *path, double threshold)
+{
+    if (threshold <= 0 || b->records < COMPACT_MIN_RECORDS ||
+        (double)b->dead < threshold * (double)b->records)
+    {
+        return -1;
+    }
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        pb_log_stats stats;
+        int result = pb_log_compact(path, threshold, &stats);
+        if (result == 1)
+        {
+            printf("Compacted %s: dropped %zu of %zu records\n", path, stats.records - stats.live, stats.records);
+        }
+        else if (result == -1)
+        {
+            perror("pbDaemon: compaction failed");
+        }
+        fflush(stdout);
+        _exit(result == -1 ? EXIT_FAILURE : EXIT_SUCCESS);
+    }
+    return pid;
+}
+
+// Create the listening socket, replacing a stale one
+static int listenOn(const char *path)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+    {
+        return -1;
+    }
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 || listen(fd, 128) == -1)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *socketPath = PB_DAEMON_SOCKET;
+    double threshold = PB_LOG_DEAD_RATIO;
+
+    // Parse command-line options
+    int opt;
+    while ((opt = getopt(argc, argv, "s:t:")) != -1)
+    {
+        switch (opt)
+        {
+        case 's':
+            socketPath = optarg;
+            break;
+        case 't':
+            threshold = strtod(optarg, NULL);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-s <socket>] [-t <deadRatio>] [phoneBook.txt]\n", argv[0]);
+            fprintf(stderr, "  -t  compact the phone book once this share of records is dead (0 = never)\n");
+            return EXIT_FAILURE;
+        }
+    }
+    const char *path = optind < argc ? argv[optind] : PHONE_BOOK;
+
+    book b;
+    memset(&b, 0, sizeof(b));
+    b.fd = -1;
+    b.chunk_cap = READ_CHUNK;
+    b.chunk = malloc(b.chunk_cap);
+    if (b.chunk == NULL || bookRehash(&b) == -1)
+    {
+        perror("malloc");
+        return EXIT_FAILURE;
+    }
+    printf("Loaded %ld records from %s\n", bookRefresh(&b, path), path);
+
+    int listenFd = listenOn(socketPath);
+    if (listenFd == -1)
+    {
+        perror(socketPath);
+        return EXIT_FAILURE;
+    }
+
+    // Watch the directory so both appends and a renamed-in replacement are seen
+    char *dirCopy = strdup(path);
+    char *baseCopy = strdup(path);
+    const char *base = basename(baseCopy);
+    int notifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (notifyFd != -1 &&
+        inotify_add_watch(notifyFd, dirname(dirCopy), IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE) == -1)
+    {
+        close(notifyFd);
+        notifyFd = -1;
+    }
+    if (notifyFd == -1)
+    {
+        fprintf(stderr, "inotify unavailable, polling for appends every %d ms\n", RESCAN_MS);
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = onSignal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    printf("Phone book daemon listening on %s\n", socketPath);
+    fflush(stdout);
+
+    client *clients = NULL;
+    struct pollfd *fds = NULL;
+    size_t nclients = 0, clientsCap = 0, fdsCap = 0;
+    pid_t compactPid = -1;
+    size_t compactedAt = 0; // Records loaded when the last compaction started
+
+    while (!stopping)
+    {
+        if (compactPid != -1 && waitpid(compactPid, NULL, WNOHANG) == compactPid)
+        {
+            compactPid = -1;
+        }
+        // A failed or unneeded compaction is not retried until the log grows
+        if (compactPid == -1 && b.records != compactedAt)
+        {
+            compactPid = startCompaction(&b, path, threshold);
+            if (compactPid != -1)
+            {
+                compactedAt = b.records;
+            }
+        }
+
+        if (reserve((char **)&fds, &fdsCap, (nclients + 2) * sizeof(*fds)) == -1)
+        {
+            break;
+        }
+        fds[0].fd = listenFd;
+        fds[0].events = POLLIN;
+        fds[1].fd = notifyFd;
+        fds[1].events = POLLIN;
+        for (size_t i = 0; i < nclients; i++)
+        {
+            fds[i + 2].fd = clients[i].fd;
+            fds[i + 2].events = (clients[i].out_len > CLIENT_OUT_HIGH || clients[i].eof ? 0 : POLLIN) |
+                                (clients[i].out_len > 0 ? POLLOUT : 0);
+        }
+
+        int ready = poll(fds, nclients + 2, notifyFd == -1 ? RESCAN_MS : -1);
+        if (ready < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("poll");
+            break;
+        }
+
+        // Pick up appended lines before answering anything queued after them
+        if (notifyFd == -1 || (fds[1].revents & POLLIN))
+        {
+            char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+            int relevant = notifyFd == -1;
+            ssize_t n;
+            while (notifyFd != -1 && (n = read(notifyFd, events, sizeof(events))) > 0)
+            {
+                for (char *p = events; p < events + n;)
+                {
+                    struct inotify_event *ev = (struct inotify_event *)p;
+                    relevant |= ev->len > 0 && strcmp(ev->name, base) == 0;
+                    p += sizeof(*ev) + ev->len;
+                }
+            }
+            if (relevant)
+            {
+                bookRefresh(&b, path);
+            }
+        }
+
+        for (size_t i = 0; i < nclients; i++)
+        {
+            short revents = fds[i + 2].revents;
+            int failed = (revents & (POLLERR | POLLNVAL)) != 0;
+            if (!failed && (revents & (POLLIN | POLLHUP)))
+            {
+                failed = serveInput(&clients[i], &b) == -1;
+            }
+            if (!failed)
+            {
+                failed = flushOutput(&clients[i]) == -1 ||
+                         (clients[i].eof && clients[i].out_len == 0);
+            }
+            if (failed)
+            {
+                dropClient(&clients[i]);
+                clients[i] = clients[--nclients];
+                fds[i + 2] = fds[nclients + 2];
+                i--;
+            }
+        }
+
+        if (fds[0].revents & POLLIN)
+        {
+            int fd;
+            while ((fd = accept4(listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1)
+            {
+                if (reserve((char **)&clients, &clientsCap, (nclients + 1) * sizeof(*clients)) == -1)
+                {
+                    close(fd);
+                    break;
+                }
+                memset(&clients[nclients], 0, sizeof(*clients));
+                clients[nclients++].fd = fd;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < nclients; i++)
+    {
+        dropClient(&clients[i]);
+    }
+    close(listenFd);
+    unlink(socketPath);
+    printf("Phone book daemon stopped\n");
+    return EXIT_SUCCESS;
+}
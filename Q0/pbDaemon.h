@@ -0,0 +1,14 @@
+#ifndef PB_DAEMON_H
+#define PB_DAEMON_H
+
+// Unix domain socket the lookup daemon listens on (relative to its working directory)
+#define PB_DAEMON_SOCKET "phoneBook.sock"
+
+// Protocol (stream socket, requests may be pipelined):
+//   request:  <exact name>\n
+//   response: "<count>\n", the number of matching records in decimal,
+//             then one "<phone>\n" line per match, in file order
+// Phones are formatted exactly like findPhone prints them, so a record with
+// no phone is an empty line; the count tells it from the end of a response.
+
+#endif
@@ -0,0 +1,134 @@
+#include "pbFile.h"
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+int pb_map_open(pb_map *map, const char *path)
+{
+    memset(map, 0, sizeof(*map));
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+    {
+        return -1;
+    }
+
+    if (fstat(fd, &map->st) == -1)
+    {
+        close(fd);
+        return -1;
+    }
+
+    map->size = (size_t)map->st.st_size;
+    if (map->size > 0)
+    {
+        void *data = mmap(NULL, map->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED)
+        {
+            close(fd);
+            return -1;
+        }
+        madvise(data, map->size, MADV_WILLNEED);
+        map->data = data;
+    }
+
+    close(fd); // The mapping stays valid after the descriptor is closed
+    return 0;
+}
+
+void pb_map_close(pb_map *map)
+{
+    if (map->data != NULL)
+    {
+        munmap((void *)map->data, map->size);
+    }
+    memset(map, 0, sizeof(*map));
+}
+
+const char *pb_line_end(const char *p, const char *end)
+{
+    const char *nl = memchr(p, '\n', (size_t)(end - p));
+    return nl != NULL ? nl : end;
+}
+
+size_t pb_name_len(const char *line, const char *end)
+{
+    const char *comma = memchr(line, ',', (size_t)(end - line));
+    return (size_t)((comma != NULL ? comma : end) - line);
+}
+
+// Locate the second comma-separated field of a line, the way `cut -d, -f2`
+// does (a line without a comma is returned whole). *end is narrowed to it
+static const char *phone_field(const char *line, const char **end)
+{
+    const char *comma = memchr(line, ',', (size_t)(*end - line));
+    if (comma == NULL)
+    {
+        return line;
+    }
+
+    const char *field = comma + 1;
+    const char *next = memchr(field, ',', (size_t)(*end - field));
+    if (next != NULL)
+    {
+        *end = next;
+    }
+    return field;
+}
+
+size_t pb_format_phone(char *out, const char *line, const char *end)
+{
+    size_t len = 0;
+    for (const char *p = phone_field(line, &end); p < end; p++)
+    {
+        if (*p != ' ')
+        {
+            out[len++] = *p;
+        }
+    }
+    return len;
+}
+
+void pb_print_phone(FILE *out, const char *line, const char *end)
+{
+    for (const char *p = phone_field(line, &end); p < end; p++)
+    {
+        if (*p != ' ')
+        {
+            putc_unlocked(*p, out);
+        }
+    }
+    putc_unlocked('\n', out);
+}
+
+size_t pb_scan_exact(const pb_map *map, const char *name, size_t len, pb_line_fn fn, void *arg)
+{
+    const char *p = map->data;
+    const char *end = p + map->size;
+    size_t matches = 0;
+
+    while (p < end)
+    {
+        const char *eol = pb_line_end(p, end);
+        if ((size_t)(eol - p) > len && p[len] == ',' && memcmp(p, name, len) == 0)
+        {
+            fn(p, eol, arg);
+            matches++;
+        }
+        p = eol + 1;
+    }
+    return matches;
+}
+
+unsigned long long pb_hash(const char *s, size_t len)
+{
+    unsigned long long h = 1469598103934665603ULL; // FNV offset basis
+    for (size_t i = 0; i < len; i++)
+    {
+        h ^= (unsigned char)s[i];
+        h *= 1099511628211ULL; // FNV prime
+    }
+    return h;
+}
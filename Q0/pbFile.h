@@ -0,0 +1,50 @@
+#ifndef PB_FILE_H
+#define PB_FILE_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <sys/stat.h>
+
+// Default phone book file used by add2PB and findPhone
+#define PHONE_BOOK "phoneBook.txt"
+
+// Read-only memory mapping of a phone book text file
+typedef struct
+{
+    const char *data; // Mapped contents (NULL when the file is empty)
+    size_t size;      // Size of the mapping in bytes
+    struct stat st;   // File status at the time it was mapped
+} pb_map;
+
+// Map the whole file read-only. Returns 0 on success, -1 on error (errno set)
+int pb_map_open(pb_map *map, const char *path);
+
+// Unmap a file mapped with pb_map_open
+void pb_map_close(pb_map *map);
+
+// Return the end of the line starting at p (the '\n' or end)
+const char *pb_line_end(const char *p, const char *end);
+
+// Return the length of the name field of a line (everything before the first comma)
+size_t pb_name_len(const char *line, const char *end);
+
+// Write the phone of a line (as pb_print_phone prints it, without the
+// newline) to out, which needs room for end - line bytes. Returns its length
+size_t pb_format_phone(char *out, const char *line, const char *end);
+
+// Print the phone of a line the way `cut -d, -f2 | sed 's/ //g'` would:
+// the second comma-separated field (the whole line if it has no comma)
+// with all spaces removed, followed by a newline
+void pb_print_phone(FILE *out, const char *line, const char *end);
+
+// Called for every line a scan matches
+typedef void (*pb_line_fn)(const char *line, const char *end, void *arg);
+
+// Call fn for every line of a mapped phone book whose name is exactly
+// name[0..len), in file order. Returns the number of matching lines
+size_t pb_scan_exact(const pb_map *map, const char *name, size_t len, pb_line_fn fn, void *arg);
+
+// 64-bit FNV-1a hash of a name
+unsigned long long pb_hash(const char *s, size_t len);
+
+#endif
@@ -0,0 +1,190 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+
+// Name parts combined into synthetic entries
+static const char *FIRST[] = {
+    "Mickey", "Ursula", "Bat Hen", "Mor", "Nezer", "Lola", "Oria Noa", "Shilo",
+    "Tsofia", "Halel", "Dana", "Avi", "Yael", "Omer", "Shira", "Itai",
+};
+static const char *LAST[] = {
+    "Mouse", "Klyne", "Krause", "Zaidenberg", "Levie", "Lev", "Cohen", "Touito",
+    "BenShalom", "Levi", "Mizrahi", "Peretz", "Biton", "Friedman", "Azulay", "Katz",
+};
+
+#define COUNT(a) (sizeof(a) / sizeof((a)[0]))
+
+// xorshift64* generator, deterministic for a given seed
+static unsigned long long rngState = 88172645463325252ULL;
+
+static unsigned long long nextRandom(void)
+{
+    rngState ^= rngState >> 12;
+    rngState ^= rngState << 25;
+    rngState ^= rngState >> 27;
+    return rngState * 2685821657736338717ULL;
+}
+
+// Uniform double in [0, 1)
+static double nextUnit(void)
+{
+    return (nextRandom() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// Cumulative Zipf(s) distribution over ranks 1..n, for inverse-CDF sampling
+static double *zipfTable(unsigned long long n, double s)
+{
+    double *cdf = malloc(n * sizeof(*cdf));
+    if (cdf == NULL)
+    {
+        return NULL;
+    }
+    double sum = 0;
+    for (unsigned long long k = 0; k < n; k++)
+    {
+        sum += 1.0 / pow((double)(k + 1), s);
+        cdf[k] = sum;
+    }
+    for (unsigned long long k = 0; k < n; k++)
+    {
+        cdf[k] /= sum;
+    }
+    return cdf;
+}
+
+// Pick a name variant: uniform, or Zipf-skewed when a table is given
+static unsigned long long nextVariant(const double *cdf, unsigned long long distinct)
+{
+    if (cdf == NULL)
+    {
+        return nextRandom() % distinct;
+    }
+    double u = nextUnit();
+    unsigned long long lo = 0, hi = distinct - 1;
+    while (lo < hi)
+    {
+        unsigned long long mid = lo + (hi - lo) / 2;
+        if (cdf[mid] < u)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// Parse sizes like 4096, 512K, 100M or 2G
+static unsigned long long parseSize(const char *text)
+{
+    char *end;
+    unsigned long long value = strtoull(text, &end, 10);
+    switch (*end)
+    {
+    case 'G': case 'g': value <<= 10; /* fall through */
+    case 'M': case 'm': value <<= 10; /* fall through */
+    case 'K': case 'k': value <<= 10;
+    }
+    return value;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned long long lines = 0, bytes = 0;
+    unsigned long long distinct = 1000000; // Numbered name variants
+    const char *output = NULL;
+    const char *distribution = "uniform";
+    double skew = 1.0;
+
+    // Parse command-line options
+    int opt;
+    while ((opt = getopt(argc, argv, "n:s:u:d:z:o:r:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            lines = strtoull(optarg, NULL, 10);
+            break;
+        case 's':
+            bytes = parseSize(optarg);
+            break;
+        case 'u':
+            distinct = strtoull(optarg, NULL, 10);
+            break;
+        case 'd':
+            distribution = optarg;
+            break;
+        case 'z':
+            skew = strtod(optarg, NULL);
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        case 'r':
+            rngState = strtoull(optarg, NULL, 10) | 1;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s (-n <lines> | -s <size>[K|M|G]) [-u <distinct>] "
+                            "[-d uniform|zipf] [-z <skew>] [-r <seed>] [-o <file>]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if ((lines == 0 && bytes == 0) || distinct == 0)
+    {
+        fprintf(stderr, "Give a line count (-n) or a size (-s)\n");
+        return EXIT_FAILURE;
+    }
+
+    // Zipf makes a few names very common (many duplicates), like real surnames
+    double *cdf = NULL;
+    if (strcmp(distribution, "zipf") == 0)
+    {
+        cdf = zipfTable(distinct, skew);
+        if (cdf == NULL)
+        {
+            perror("malloc");
+            return EXIT_FAILURE;
+        }
+    }
+    else if (strcmp(distribution, "uniform") != 0)
+    {
+        fprintf(stderr, "Unknown distribution %s (use uniform or zipf)\n", distribution);
+        return EXIT_FAILURE;
+    }
+
+    FILE *out = output != NULL ? fopen(output, "w") : stdout;
+    if (out == NULL)
+    {
+        perror(output);
+        return EXIT_FAILURE;
+    }
+    setvbuf(out, NULL, _IOFBF, 1 << 20);
+
+    // Entries look like "Shira Levi4821,052-1234567"
+    unsigned long long written = 0;
+    for (unsigned long long i = 0; lines > 0 ? i < lines : written < bytes; i++)
+    {
+        unsigned long long r = nextRandom();
+        int n = fprintf(out, "%s %s%llu,05%llu-%07llu\n",
+                        FIRST[r % COUNT(FIRST)], LAST[(r >> 8) % COUNT(LAST)],
+                        nextVariant(cdf, distinct), (r >> 40) % 10, nextRandom() % 10000000);
+        if (n < 0)
+        {
+            perror("write");
+            return EXIT_FAILURE;
+        }
+        written += (unsigned long long)n;
+    }
+
+    free(cdf);
+    if (fclose(out) != 0)
+    {
+        perror("close");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
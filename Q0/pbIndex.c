@@ -0,0 +1,262 @@
+#include "pbIndex.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define PB_INDEX_MAGIC "PBIDX01"
+#define PB_INDEX_SUFFIX ".idx"
+
+// On-disk layout of the cache: this header followed by `count` entries
+typedef struct
+{
+    char magic[8];
+    unsigned long long size;       // Size of the indexed phone book
+    unsigned long long ino;        // Inode of the indexed phone book
+    unsigned long long mtime_sec;  // Modification time of the indexed phone book
+    unsigned long long mtime_nsec;
+    unsigned long long count;      // Number of entries that follow
+} pb_index_header;
+
+static int compare_entries(const void *a, const void *b)
+{
+    const pb_index_entry *x = a;
+    const pb_index_entry *y = b;
+    if (x->hash != y->hash)
+    {
+        return x->hash < y->hash ? -1 : 1;
+    }
+    if (x->offset != y->offset)
+    {
+        return x->offset < y->offset ? -1 : 1;
+    }
+    return 0;
+}
+
+// Fill a header describing the currently mapped phone book
+static void fill_header(pb_index_header *header, const pb_map *map, size_t count)
+{
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, PB_INDEX_MAGIC, sizeof(header->magic));
+    header->size = map->size;
+    header->ino = map->st.st_ino;
+    header->mtime_sec = map->st.st_mtim.tv_sec;
+    header->mtime_nsec = map->st.st_mtim.tv_nsec;
+    header->count = count;
+}
+
+// Try to use an existing cache file. Returns 0 if it is valid for the mapped file
+static int load_cache(pb_index *ix, const char *cache_path)
+{
+    int fd = open(cache_path, O_RDONLY);
+    if (fd == -1)
+    {
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(pb_index_header))
+    {
+        close(fd);
+        return -1;
+    }
+
+    void *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        return -1;
+    }
+
+    pb_index_header expected;
+    const pb_index_header *header = data;
+    fill_header(&expected, &ix->map, header->count);
+    if (memcmp(header, &expected, sizeof(expected)) != 0 ||
+        (size_t)st.st_size != sizeof(*header) + header->count * sizeof(pb_index_entry))
+    {
+        munmap(data, (size_t)st.st_size);
+        return -1;
+    }
+
+    ix->cache = data;
+    ix->cache_size = (size_t)st.st_size;
+    ix->cache_mapped = 1;
+    ix->entries = (const pb_index_entry *)(header + 1);
+    ix->count = header->count;
+    return 0;
+}
+
+// Write the cache next to the phone book; a temporary file plus rename
+// keeps concurrent readers from seeing a half-written index
+static void store_cache(const pb_index *ix, const char *cache_path)
+{
+    size_t tmp_len = strlen(cache_path) + sizeof(".XXXXXX");
+    char *tmp_path = malloc(tmp_len);
+    if (tmp_path == NULL)
+    {
+        return;
+    }
+    snprintf(tmp_path, tmp_len, "%s.XXXXXX", cache_path);
+
+    int fd = mkstemp(tmp_path);
+    if (fd == -1)
+    {
+        free(tmp_path);
+        return;
+    }
+    fchmod(fd, 0644); // mkstemp creates the file owner-only
+
+    const char *p = ix->cache;
+    size_t left = ix->cache_size;
+    while (left > 0)
+    {
+        ssize_t n = write(fd, p, left);
+        if (n <= 0)
+        {
+            break;
+        }
+        p += n;
+        left -= (size_t)n;
+    }
+
+    if (close(fd) == -1 || left != 0 || rename(tmp_path, cache_path) == -1)
+    {
+        unlink(tmp_path);
+    }
+    free(tmp_path);
+}
+
+// Scan the mapped phone book and build a sorted index in heap memory
+static int build_index(pb_index *ix)
+{
+    const char *p = ix->map.data;
+    const char *end = p + ix->map.size;
+
+    size_t lines = 0;
+    for (const char *q = p; q < end; q = pb_line_end(q, end) + 1)
+    {
+        lines++;
+    }
+
+    pb_index_header *header = malloc(sizeof(*header) + lines * sizeof(pb_index_entry));
+    if (header == NULL)
+    {
+        return -1;
+    }
+    pb_index_entry *entries = (pb_index_entry *)(header + 1);
+
+    size_t count = 0;
+    while (p < end)
+    {
+        const char *eol = pb_line_end(p, end);
+        if (eol > p)
+        {
+            size_t len = pb_name_len(p, eol);
+            entries[count].hash = pb_hash(p, len);
+            entries[count].offset = (unsigned long long)(p - ix->map.data);
+            count++;
+        }
+        p = eol + 1;
+    }
+
+    qsort(entries, count, sizeof(*entries), compare_entries);
+    fill_header(header, &ix->map, count);
+
+    ix->cache = header;
+    ix->cache_size = sizeof(*header) + count * sizeof(pb_index_entry);
+    ix->cache_mapped = 0;
+    ix->entries = entries;
+    ix->count = count;
+    return 0;
+}
+
+int pb_index_open(pb_index *ix, const char *path)
+{
+    memset(ix, 0, sizeof(*ix));
+    if (pb_map_open(&ix->map, path) == -1)
+    {
+        return -1;
+    }
+
+    size_t cache_len = strlen(path) + sizeof(PB_INDEX_SUFFIX);
+    char *cache_path = malloc(cache_len);
+    if (cache_path == NULL)
+    {
+        pb_map_close(&ix->map);
+        errno = ENOMEM;
+        return -1;
+    }
+    snprintf(cache_path, cache_len, "%s%s", path, PB_INDEX_SUFFIX);
+
+    if (load_cache(ix, cache_path) == -1)
+    {
+        if (build_index(ix) == -1)
+        {
+            free(cache_path);
+            pb_map_close(&ix->map);
+            errno = ENOMEM;
+            return -1;
+        }
+        store_cache(ix, cache_path);
+    }
+
+    free(cache_path);
+    return 0;
+}
+
+void pb_index_close(pb_index *ix)
+{
+    if (ix->cache != NULL)
+    {
+        if (ix->cache_mapped)
+        {
+            munmap(ix->cache, ix->cache_size);
+        }
+        else
+        {
+            free(ix->cache);
+        }
+    }
+    pb_map_close(&ix->map);
+    memset(ix, 0, sizeof(*ix));
+}
+
+size_t pb_index_lookup(const pb_index *ix, const char *name, size_t len, pb_line_fn fn, void *arg)
+{
+    unsigned long long hash = pb_hash(name, len);
+
+    // Binary search for the first entry with this hash
+    size_t lo = 0;
+    size_t hi = ix->count;
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if (ix->entries[mid].hash < hash)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    // Equal hashes are sorted by offset; compare names to skip collisions
+    const char *end = ix->map.data + ix->map.size;
+    size_t matches = 0;
+    for (size_t i = lo; i < ix->count && ix->entries[i].hash == hash; i++)
+    {
+        const char *line = ix->map.data + ix->entries[i].offset;
+        const char *eol = pb_line_end(line, end);
+        if (pb_name_len(line, eol) == len && memcmp(line, name, len) == 0)
+        {
+            fn(line, eol, arg);
+            matches++;
+        }
+    }
+    return matches;
+}
@@ -0,0 +1,38 @@
+#ifndef PB_INDEX_H
+#define PB_INDEX_H
+
+#include "pbFile.h"
+
+// One index slot: hash of the name and byte offset of its line
+typedef struct
+{
+    unsigned long long hash;
+    unsigned long long offset;
+} pb_index_entry;
+
+// Name index over a memory-mapped phone book.
+// Entries are sorted by (hash, offset) so equal names come out in file order.
+typedef struct
+{
+    pb_map map;                    // The phone book itself
+    const pb_index_entry *entries; // Sorted index entries
+    size_t count;                  // Number of entries
+    void *cache;                   // Mapping of the cache file (or heap copy)
+    size_t cache_size;             // Size of that mapping
+    int cache_mapped;              // 1 if cache is an mmap, 0 if heap memory
+} pb_index;
+
+// Open the phone book and load its index from "<path>.idx".
+// The cache is rebuilt when the phone book size, inode or mtime changed.
+// If the cache cannot be written the index is kept in memory only.
+// Returns 0 on success, -1 on error (errno set)
+int pb_index_open(pb_index *ix, const char *path);
+
+// Release everything held by an index
+void pb_index_close(pb_index *ix);
+
+// Call fn for every line whose name is exactly name[0..len), in file order.
+// Returns the number of matching lines
+size_t pb_index_lookup(const pb_index *ix, const char *name, size_t len, pb_line_fn fn, void *arg);
+
+#endif
@@ -0,0 +1,573 @@
+#define _GNU_SOURCE
+#include "pbLog.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+
+// One line of the log while resolving it
+typedef struct
+{
+    const char *line;
+    const char *end;
+    long prev_live; // Previous live line of the same name, or -1
+    char live;
+} log_line;
+
+// Third comma-separated field of a line, or NULL. *end is narrowed to it
+static const char *op_field(const char *line, const char **end)
+{
+    const char *comma = memchr(line, ',', (size_t)(*end - line));
+    if (comma == NULL)
+    {
+        return NULL;
+    }
+    comma = memchr(comma + 1, ',', (size_t)(*end - comma - 1));
+    if (comma == NULL)
+    {
+        return NULL;
+    }
+    const char *field = comma + 1;
+    while (*end > field && ((*end)[-1] == ' ' || (*end)[-1] == '\r'))
+    {
+        (*end)--;
+    }
+    return field;
+}
+
+pb_op pb_line_op(const char *line, const char *end)
+{
+    const char *field = op_field(line, &end);
+    if (field == NULL || end - field != 3)
+    {
+        return PB_OP_ADD;
+    }
+    if (memcmp(field, PB_OP_SET_FIELD, 3) == 0)
+    {
+        return PB_OP_SET;
+    }
+    if (memcmp(field, PB_OP_DEL_FIELD, 3) == 0)
+    {
+        return PB_OP_DEL;
+    }
+    return PB_OP_ADD;
+}
+
+void pb_live_apply(const char *line, const char *end, void *arg)
+{
+    pb_live *live = arg;
+    pb_op op = pb_line_op(line, end);
+    if (op != PB_OP_ADD)
+    {
+        live->count = 0; // Upserts and tombstones hide everything before them
+    }
+    if (op == PB_OP_DEL)
+    {
+        return;
+    }
+
+    if (live->count == live->cap)
+    {
+        size_t cap = live->cap > 0 ? live->cap * 2 : 8;
+        const char **lines = realloc(live->lines, cap * sizeof(*lines));
+        if (lines == NULL)
+        {
+            live->failed = 1;
+            return;
+        }
+        live->lines = lines;
+        const char **ends = realloc(live->ends, cap * sizeof(*ends));
+        if (ends == NULL)
+        {
+            live->failed = 1;
+            return;
+        }
+        live->ends = ends;
+        live->cap = cap;
+    }
+    live->lines[live->count] = line;
+    live->ends[live->count] = end;
+    live->count++;
+}
+
+void pb_live_free(pb_live *live)
+{
+    free(live->lines);
+    free(live->ends);
+    memset(live, 0, sizeof(*live));
+}
+
+int pb_log_resolve(const pb_map *map, pb_line_fn fn, void *arg, pb_log_stats *stats)
+{
+    const char *p = map->data;
+    const char *end = p + map->size;
+
+    size_t count = 0;
+    for (const char *q = p; q < end; q = pb_line_end(q, end) + 1)
+    {
+        count++;
+    }
+
+    // Open addressing table from a name to its newest live line
+    size_t nslots = 16;
+    while (nslots < count * 2)
+    {
+        nslots *= 2;
+    }
+    log_line *lines = malloc((count + 1) * sizeof(*lines));
+    long *slotName = malloc(nslots * sizeof(*slotName)); // Any line with the slot's name
+    long *slotLive = malloc(nslots * sizeof(*slotLive));
+    if (lines == NULL || slotName == NULL || slotLive == NULL)
+    {
+        free(lines);
+        free(slotName);
+        free(slotLive);
+        errno = ENOMEM;
+        return -1;
+    }
+    memset(slotName, -1, nslots * sizeof(*slotName));
+
+    size_t n = 0, live = 0;
+    while (p < end)
+    {
+        const char *eol = pb_line_end(p, end);
+        if (eol > p)
+        {
+            log_line *l = &lines[n];
+            l->line = p;
+            l->end = eol;
+
+            size_t len = pb_name_len(p, eol);
+            size_t slot = pb_hash(p, len) & (nslots - 1);
+            while (slotName[slot] != -1)
+            {
+                const log_line *other = &lines[slotName[slot]];
+                if (pb_name_len(other->line, other->end) == len && memcmp(other->line, p, len) == 0)
+                {
+                    break;
+                }
+                slot = (slot + 1) & (nslots - 1);
+            }
+            if (slotName[slot] == -1)
+            {
+                slotName[slot] = (long)n;
+                slotLive[slot] = -1;
+            }
+
+            pb_op op = pb_line_op(p, eol);
+            if (op != PB_OP_ADD)
+            {
+                for (long i = slotLive[slot]; i != -1; i = lines[i].prev_live)
+                {
+                    lines[i].live = 0;
+                    live--;
+                }
+                slotLive[slot] = -1;
+            }
+            l->live = op != PB_OP_DEL;
+            l->prev_live = -1;
+            if (l->live)
+            {
+                l->prev_live = slotLive[slot];
+                slotLive[slot] = (long)n;
+                live++;
+            }
+            n++;
+        }
+        p = eol + 1;
+    }
+
+    for (size_t i = 0; i < n; i++)
+    {
+        if (lines[i].live && fn != NULL)
+        {
+            fn(lines[i].line, lines[i].end, arg);
+        }
+    }
+    if (stats != NULL)
+    {
+        stats->records = n;
+        stats->live = live;
+    }
+
+    free(lines);
+    free(slotName);
+    free(slotLive);
+    return 0;
+}
+
+// Write one live line to the compacted log; an upsert has nothing left to
+// replace, so it is written as a plain add
+static void writeLive(const char *line, const char *end, void *arg)
+{
+    FILE *out = arg;
+    if (pb_line_op(line, end) == PB_OP_SET)
+    {
+        const char *stop = end;
+        end = op_field(line, &stop) - 1; // Drop ",set"
+    }
+    fwrite(line, 1, (size_t)(end - line), out);
+    putc_unlocked('\n', out);
+}
+
+// Write the live lines of map to a temporary file and rename it over path
+static int rewriteLive(const pb_map *map, const char *path)
+{
+    size_t tmpLen = strlen(path) + sizeof(".XXXXXX");
+    char *tmpPath = malloc(tmpLen);
+    if (tmpPath == NULL)
+    {
+        return -1;
+    }
+    snprintf(tmpPath, tmpLen, "%s.XXXXXX", path);
+
+    int fd = mkstemp(tmpPath);
+    if (fd == -1)
+    {
+        free(tmpPath);
+        return -1;
+    }
+    fchmod(fd, map->st.st_mode & 0777); // mkstemp creates the file owner-only
+    FILE *out = fdopen(fd, "w");
+    if (out == NULL)
+    {
+        close(fd);
+        unlink(tmpPath);
+        free(tmpPath);
+        return -1;
+    }
+
+    int ok = pb_log_resolve(map, writeLive, out, NULL) == 0 && fflush(out) == 0 && fdatasync(fd) == 0;
+    ok = fclose(out) == 0 && ok;
+    if (!ok || rename(tmpPath, path) == -1)
+    {
+        int saved = errno;
+        unlink(tmpPath);
+        free(tmpPath);
+        errno = saved;
+        return -1;
+    }
+    free(tmpPath);
+    return 0;
+}
+
+#define PB_OPS_MAGIC "PBOPS01"
+#define PB_OPS_SUFFIX ".ops"
+#define PB_OPS_TAIL 64 // Bytes hashed to notice a log rewritten in place
+
+// On-disk layout of the record cache: this header followed by the offsets
+// of `count` upserts and tombstones, the ones in the first `size` bytes
+typedef struct
+{
+    char magic[8];
+    unsigned long long ino;   // Inode of the log
+    unsigned long long size;  // Bytes searched, always whole lines
+    unsigned long long tail;  // pb_hash of the last PB_OPS_TAIL of them
+    unsigned long long count; // Offsets that follow
+} ops_header;
+
+// Offsets of the records found so far
+typedef struct
+{
+    unsigned long long *offsets;
+    size_t count, cap;
+} ops_list;
+
+static int ops_push(ops_list *list, unsigned long long offset)
+{
+    if (list->count == list->cap)
+    {
+        size_t cap = list->cap > 0 ? list->cap * 2 : 64;
+        unsigned long long *offsets = realloc(list->offsets, cap * sizeof(*offsets));
+        if (offsets == NULL)
+        {
+            return -1;
+        }
+        list->offsets = offsets;
+        list->cap = cap;
+    }
+    list->offsets[list->count++] = offset;
+    return 0;
+}
+
+static unsigned long long ops_tail(const pb_map *map, size_t size)
+{
+    size_t len = size < PB_OPS_TAIL ? size : PB_OPS_TAIL;
+    return pb_hash(map->data + size - len, len);
+}
+
+// Load the cached offsets if they were found in this very log, which may
+// only have grown since. Returns the bytes they cover, or 0 if none apply
+static size_t ops_load(const pb_map *map, const char *cache_path, ops_list *list)
+{
+    FILE *in = fopen(cache_path, "rb");
+    if (in == NULL)
+    {
+        return 0;
+    }
+    ops_header header;
+    size_t covered = 0;
+    if (fread(&header, sizeof(header), 1, in) == 1 && memcmp(header.magic, PB_OPS_MAGIC, sizeof(header.magic)) == 0 &&
+        header.ino == map->st.st_ino && header.size <= map->size && header.tail == ops_tail(map, header.size))
+    {
+        list->offsets = malloc((header.count > 0 ? header.count : 1) * sizeof(*list->offsets));
+        if (list->offsets != NULL && fread(list->offsets, sizeof(*list->offsets), header.count, in) == header.count)
+        {
+            list->count = list->cap = header.count;
+            covered = header.size;
+        }
+        else
+        {
+            free(list->offsets);
+            memset(list, 0, sizeof(*list));
+        }
+    }
+    fclose(in);
+    return covered;
+}
+
+// Write the cache next to the log; a temporary file plus rename keeps
+// concurrent readers from seeing a half-written one
+static void ops_store(const pb_map *map, size_t covered, const ops_list *list, const char *cache_path)
+{
+    size_t tmpLen = strlen(cache_path) + sizeof(".XXXXXX");
+    char *tmpPath = malloc(tmpLen);
+    if (tmpPath == NULL)
+    {
+        return;
+    }
+    snprintf(tmpPath, tmpLen, "%s.XXXXXX", cache_path);
+
+    int fd = mkstemp(tmpPath);
+    FILE *out = fd != -1 ? fdopen(fd, "wb") : NULL;
+    if (out == NULL)
+    {
+        if (fd != -1)
+        {
+            close(fd);
+            unlink(tmpPath);
+        }
+        free(tmpPath);
+        return;
+    }
+    fchmod(fd, 0644); // mkstemp creates the file owner-only
+
+    ops_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, PB_OPS_MAGIC, sizeof(header.magic));
+    header.ino = map->st.st_ino;
+    header.size = covered;
+    header.tail = ops_tail(map, covered);
+    header.count = list->count;
+    int ok = fwrite(&header, sizeof(header), 1, out) == 1 &&
+             fwrite(list->offsets, sizeof(*list->offsets), list->count, out) == list->count;
+    if (fclose(out) != 0 || !ok || rename(tmpPath, cache_path) == -1)
+    {
+        unlink(tmpPath);
+    }
+    free(tmpPath);
+}
+
+// Add the upserts and tombstones among the whole lines of map[from, to)
+static int ops_search(const pb_map *map, size_t from, size_t to, ops_list *list)
+{
+    static const char *const fields[] = {"," PB_OP_SET_FIELD, "," PB_OP_DEL_FIELD};
+    const char *end = map->data + to;
+    for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++)
+    {
+        const char *p = map->data + from;
+        const char *hit;
+        while (p < end && (hit = memmem(p, (size_t)(end - p), fields[i], 4)) != NULL)
+        {
+            const char *line = hit;
+            while (line > map->data + from && line[-1] != '\n')
+            {
+                line--;
+            }
+            const char *eol = pb_line_end(hit, end);
+            if (pb_line_op(line, eol) == (i == 0 ? PB_OP_SET : PB_OP_DEL) &&
+                ops_push(list, (unsigned long long)(line - map->data)) == -1)
+            {
+                return -1;
+            }
+            p = eol;
+        }
+    }
+    return 0;
+}
+
+// Slot of name in the table of newest records, or of the empty slot it would take
+static size_t ops_slot(const pb_log_ops *ops, const char *name, size_t len)
+{
+    const char *end = ops->map.data + ops->map.size;
+    size_t slot = pb_hash(name, len) & (ops->slots - 1);
+    while (ops->newest[slot] != -1)
+    {
+        const char *line = ops->map.data + ops->newest[slot];
+        if (pb_name_len(line, end) == len && memcmp(line, name, len) == 0)
+        {
+            break;
+        }
+        slot = (slot + 1) & (ops->slots - 1);
+    }
+    return slot;
+}
+
+int pb_log_ops_open(pb_log_ops *ops, int fd, const char *path)
+{
+    memset(ops, 0, sizeof(*ops));
+    if (fstat(fd, &ops->map.st) == -1)
+    {
+        return -1;
+    }
+
+    // Only the appended bytes and the records themselves are read, so the
+    // mapping is not read ahead the way pb_map_open does
+    ops->map.size = (size_t)ops->map.st.st_size;
+    if (ops->map.size > 0)
+    {
+        void *data = mmap(NULL, ops->map.size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED)
+        {
+            return -1;
+        }
+        ops->map.data = data;
+    }
+
+    size_t cacheLen = strlen(path) + sizeof(PB_OPS_SUFFIX);
+    char *cachePath = malloc(cacheLen);
+    if (cachePath == NULL)
+    {
+        pb_map_close(&ops->map);
+        errno = ENOMEM;
+        return -1;
+    }
+    snprintf(cachePath, cacheLen, "%s%s", path, PB_OPS_SUFFIX);
+
+    // Search what was appended since the cache was written, up to the last whole line
+    ops_list list = {0};
+    size_t covered = ops_load(&ops->map, cachePath, &list);
+    const char *last = ops->map.size > covered ? memrchr(ops->map.data + covered, '\n', ops->map.size - covered) : NULL;
+    if (last != NULL)
+    {
+        size_t complete = (size_t)(last - ops->map.data) + 1;
+        if (ops_search(&ops->map, covered, complete, &list) == -1)
+        {
+            free(list.offsets);
+            free(cachePath);
+            pb_map_close(&ops->map);
+            errno = ENOMEM;
+            return -1;
+        }
+        covered = complete;
+        ops_store(&ops->map, covered, &list, cachePath);
+    }
+    free(cachePath);
+
+    ops->slots = 16;
+    while (ops->slots < list.count * 2)
+    {
+        ops->slots *= 2;
+    }
+    ops->newest = malloc(ops->slots * sizeof(*ops->newest));
+    if (ops->newest == NULL)
+    {
+        free(list.offsets);
+        pb_map_close(&ops->map);
+        errno = ENOMEM;
+        return -1;
+    }
+    memset(ops->newest, -1, ops->slots * sizeof(*ops->newest));
+    for (size_t i = 0; i < list.count; i++)
+    {
+        const char *line = ops->map.data + list.offsets[i];
+        size_t slot = ops_slot(ops, line, pb_name_len(line, ops->map.data + ops->map.size));
+        if (ops->newest[slot] < (long long)list.offsets[i])
+        {
+            ops->names += ops->newest[slot] == -1;
+            ops->newest[slot] = (long long)list.offsets[i];
+        }
+    }
+    free(list.offsets);
+    return 0;
+}
+
+int pb_log_ops_live(const pb_log_ops *ops, const char *line, const char *end, unsigned long long offset)
+{
+    if (pb_line_op(line, end) == PB_OP_DEL)
+    {
+        return 0;
+    }
+    if (ops->names == 0)
+    {
+        return 1;
+    }
+    long long newest = ops->newest[ops_slot(ops, line, pb_name_len(line, end))];
+    return newest == -1 || (unsigned long long)newest <= offset;
+}
+
+void pb_log_ops_close(pb_log_ops *ops)
+{
+    free(ops->newest);
+    pb_map_close(&ops->map);
+    memset(ops, 0, sizeof(*ops));
+}
+
+int pb_log_compact(const char *path, double threshold, pb_log_stats *stats)
+{
+    if (stats != NULL)
+    {
+        memset(stats, 0, sizeof(*stats));
+    }
+
+    // Lock the file being replaced: add2PB takes the same lock to append,
+    // and checks afterwards whether the file it locked is still current
+    int lockFd = open(path, O_RDONLY);
+    if (lockFd == -1)
+    {
+        return -1;
+    }
+    pb_map map;
+    if (flock(lockFd, LOCK_EX) == -1 || pb_map_open(&map, path) == -1)
+    {
+        int saved = errno;
+        close(lockFd);
+        errno = saved;
+        return -1;
+    }
+
+    // Another compaction may have replaced the file while we waited
+    struct stat locked;
+    if (fstat(lockFd, &locked) == -1 || locked.st_ino != map.st.st_ino)
+    {
+        pb_map_close(&map);
+        close(lockFd);
+        return 0;
+    }
+
+    // Count first, so a healthy log is not rewritten
+    pb_log_stats counts;
+    int result = pb_log_resolve(&map, NULL, NULL, &counts);
+    if (result == 0)
+    {
+        if (stats != NULL)
+        {
+            *stats = counts;
+        }
+        if (counts.records > 0 &&
+            (double)(counts.records - counts.live) >= threshold * (double)counts.records)
+        {
+            result = rewriteLive(&map, path) == 0 ? 1 : -1;
+        }
+    }
+
+    int saved = errno;
+    pb_map_close(&map);
+    close(lockFd);
+    errno = saved;
+    return result;
+}
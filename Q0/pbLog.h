@@ -0,0 +1,82 @@
+#ifndef PB_LOG_H
+#define PB_LOG_H
+
+#include "pbFile.h"
+
+// The phone book is an append-only log. An optional third field says what a
+// line does to its name:
+//   Name,Phone       adds a phone (every line written before this format)
+//   Name,Phone,set   replaces all earlier phones of Name (upsert)
+//   Name,,del        removes all earlier phones of Name (tombstone)
+// Readers apply the lines in file order, so the latest one wins
+typedef enum
+{
+    PB_OP_ADD,
+    PB_OP_SET,
+    PB_OP_DEL
+} pb_op;
+
+#define PB_OP_SET_FIELD "set"
+#define PB_OP_DEL_FIELD "del"
+
+// Compact the log once at least this share of its records is dead
+#define PB_LOG_DEAD_RATIO 0.5
+
+// Return the operation recorded by a line
+pb_op pb_line_op(const char *line, const char *end);
+
+// Live phones of one name, built by feeding it that name's lines in file
+// order through pb_live_apply (a pb_line_fn)
+typedef struct
+{
+    const char **lines;
+    const char **ends;
+    size_t count, cap;
+    int failed; // Out of memory; the result is incomplete
+} pb_live;
+
+void pb_live_apply(const char *line, const char *end, void *arg);
+void pb_live_free(pb_live *live);
+
+// Record counts of a resolved log
+typedef struct
+{
+    size_t records; // Non-empty lines
+    size_t live;    // Lines still visible to readers
+} pb_log_stats;
+
+// Resolve a whole log in one pass and call fn for every live line, in file
+// order. stats may be NULL. Returns 0, or -1 if memory ran out
+int pb_log_resolve(const pb_map *map, pb_line_fn fn, void *arg, pb_log_stats *stats);
+
+// Newest upsert or tombstone of every name that has one, for the substring
+// scans: they read the raw log and check only the lines they match, without
+// resolving the whole log. The offsets of the records are cached in
+// "<path>.ops"; while the log only grows, just the bytes appended since are
+// searched for new ones
+typedef struct
+{
+    pb_map map;         // The log, as of opening
+    long long *newest;  // Hash table: offset of a name's newest record, or -1
+    size_t slots;       // Size of the table, a power of two
+    size_t names;       // Names with a record
+} pb_log_ops;
+
+// Find the records of the log open as fd, found at path. Returns 0, or -1
+// on error (errno set)
+int pb_log_ops_open(pb_log_ops *ops, int fd, const char *path);
+
+// Whether the line at offset is still live: not a tombstone, nor followed
+// by a record for its name. Records past the opened log are not seen
+int pb_log_ops_live(const pb_log_ops *ops, const char *line, const char *end, unsigned long long offset);
+
+void pb_log_ops_close(pb_log_ops *ops);
+
+// If at least `threshold` of the records in path are dead, rewrite it with
+// only the live ones (upserts become plain adds) and atomically rename the
+// result over it. Appenders are held off with an exclusive flock meanwhile.
+// stats (may be NULL) receives the counts found before compacting.
+// Returns 1 if the file was rewritten, 0 if it was not needed, -1 on error
+int pb_log_compact(const char *path, double threshold, pb_log_stats *stats);
+
+#endif
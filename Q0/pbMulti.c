@@ -0,0 +1,159 @@
+#include "pbMulti.h"
+#include "pbFile.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+int pb_multi_build(pb_multi *m, char *const *patterns, size_t count)
+{
+    memset(m, 0, sizeof(*m));
+
+    // Byte classes: every byte used by a pattern gets its own class
+    size_t maxStates = 1;
+    for (size_t i = 0; i < count; i++)
+    {
+        for (const unsigned char *p = (const unsigned char *)patterns[i]; *p != '\0'; p++)
+        {
+            if (m->classOf[*p] == 0)
+            {
+                m->classOf[*p] = (unsigned char)++m->classes;
+            }
+            maxStates++;
+        }
+    }
+    m->classes++; // Class 0 stands for every other byte, '\n' included
+
+    m->patterns = malloc((count + 1) * sizeof(*m->patterns));
+    m->next = malloc(maxStates * m->classes * sizeof(*m->next));
+    m->out = malloc(maxStates * sizeof(*m->out));
+    m->dict = malloc(maxStates * sizeof(*m->dict));
+    int *fail = malloc(maxStates * sizeof(*fail));
+    int *queue = malloc(maxStates * sizeof(*queue));
+    if (m->patterns == NULL || m->next == NULL || m->out == NULL || m->dict == NULL ||
+        fail == NULL || queue == NULL)
+    {
+        free(fail);
+        free(queue);
+        pb_multi_free(m);
+        return -1;
+    }
+    memset(m->next, -1, maxStates * m->classes * sizeof(*m->next));
+    memset(m->out, -1, maxStates * sizeof(*m->out));
+    memset(m->dict, -1, maxStates * sizeof(*m->dict));
+    m->states = 1;
+
+    // Trie of all patterns; a repeated pattern ends on a state that already has an output
+    for (size_t i = 0; i < count; i++)
+    {
+        if (patterns[i][0] == '\0')
+        {
+            continue;
+        }
+        int s = 0;
+        for (const unsigned char *p = (const unsigned char *)patterns[i]; *p != '\0'; p++)
+        {
+            int *edge = &m->next[(size_t)s * m->classes + m->classOf[*p]];
+            if (*edge == -1)
+            {
+                *edge = (int)m->states++;
+            }
+            s = *edge;
+        }
+        if (m->out[s] == -1)
+        {
+            m->out[s] = (int)m->count;
+            m->patterns[m->count++] = patterns[i];
+        }
+    }
+
+    // Breadth-first: failure links, output links and the missing DFA edges
+    size_t head = 0, tail = 0;
+    fail[0] = 0;
+    for (size_t c = 0; c < m->classes; c++)
+    {
+        int t = m->next[c];
+        if (t == -1)
+        {
+            m->next[c] = 0;
+        }
+        else
+        {
+            fail[t] = 0;
+            queue[tail++] = t;
+        }
+    }
+    while (head < tail)
+    {
+        int s = queue[head++];
+        for (size_t c = 0; c < m->classes; c++)
+        {
+            int *edge = &m->next[(size_t)s * m->classes + c];
+            int viaFail = m->next[(size_t)fail[s] * m->classes + c];
+            if (*edge == -1)
+            {
+                *edge = viaFail;
+                continue;
+            }
+            int t = *edge;
+            fail[t] = viaFail;
+            m->dict[t] = m->out[viaFail] != -1 ? viaFail : m->dict[viaFail];
+            queue[tail++] = t;
+        }
+    }
+
+    free(fail);
+    free(queue);
+    return 0;
+}
+
+void pb_multi_free(pb_multi *m)
+{
+    free(m->patterns);
+    free(m->next);
+    free(m->out);
+    free(m->dict);
+    memset(m, 0, sizeof(*m));
+}
+
+size_t pb_multi_scan_buffer(const pb_multi *m, const char *data, size_t n, pb_multi_fn fn, void *arg)
+{
+    // Line number each pattern was last reported on, to report it once per line
+    size_t *lastLine = calloc(m->count > 0 ? m->count : 1, sizeof(*lastLine));
+    if (lastLine == NULL)
+    {
+        return 0;
+    }
+
+    const char *end = data + n;
+    const char *lineStart = data;
+    size_t line = 1;
+    size_t matches = 0;
+    int state = 0;
+
+    for (const char *p = data; p < end; p++)
+    {
+        unsigned char c = (unsigned char)*p;
+        if (c == '\n')
+        {
+            state = 0;
+            lineStart = p + 1;
+            line++;
+            continue;
+        }
+
+        state = m->next[(size_t)state * m->classes + m->classOf[c]];
+        for (int s = m->out[state] != -1 ? state : m->dict[state]; s != -1; s = m->dict[s])
+        {
+            int id = m->out[s];
+            if (lastLine[id] != line)
+            {
+                lastLine[id] = line;
+                fn((size_t)id, lineStart, pb_line_end(p, end), arg);
+                matches++;
+            }
+        }
+    }
+
+    free(lastLine);
+    return matches;
+}
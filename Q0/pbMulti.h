@@ -0,0 +1,35 @@
+#ifndef PB_MULTI_H
+#define PB_MULTI_H
+
+#include <stddef.h>
+
+// Aho-Corasick automaton matching many fixed strings in one pass.
+// Bytes are mapped to classes (one per byte value used by a pattern plus
+// one for everything else) so the full DFA table stays small.
+typedef struct
+{
+    char **patterns;          // Distinct patterns, indexed by id
+    size_t count;
+    unsigned char classOf[256];
+    size_t classes;           // Number of byte classes
+    int *next;                // DFA: next[state * classes + class]
+    int *out;                 // Pattern id ending at a state, or -1
+    int *dict;                // Nearest state on the failure chain with an output, or -1
+    size_t states;
+} pb_multi;
+
+// Called once per (pattern, line) match, lines in file order
+typedef void (*pb_multi_fn)(size_t id, const char *line, const char *end, void *arg);
+
+// Build an automaton for the given patterns (duplicates are merged,
+// empty patterns ignored). Returns 0 on success, -1 when out of memory
+int pb_multi_build(pb_multi *m, char *const *patterns, size_t count);
+
+// Release an automaton
+void pb_multi_free(pb_multi *m);
+
+// Report every pattern found in each line of data[0..n).
+// Returns the number of (pattern, line) matches
+size_t pb_multi_scan_buffer(const pb_multi *m, const char *data, size_t n, pb_multi_fn fn, void *arg);
+
+#endif
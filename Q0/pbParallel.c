@@ -0,0 +1,265 @@
+#define _GNU_SOURCE
+#include "pbParallel.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define SHARD_EXTEND (64 << 10) // Read this much more at a time to finish the last line
+#define WINDOW_PER_THREAD 4     // Shards allowed in flight per worker
+
+// State shared by the workers and the thread emitting results
+typedef struct
+{
+    int fd;
+    off_t size;
+    size_t nshards;
+    pb_shard_fn fn;
+    void *ctx;
+
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    size_t next;     // Next shard to claim
+    size_t emitted;  // Shards already written out
+    size_t window;   // Max shards claimed but not yet written
+    char **results;  // Output of every finished shard
+    size_t *lengths;
+    char *done;
+    long matches;
+    int failed;
+} shard_pool;
+
+// pread the whole range, retrying short reads. Returns bytes read or -1
+static ssize_t readAt(int fd, char *buf, size_t len, off_t off)
+{
+    size_t got = 0;
+    while (got < len)
+    {
+        ssize_t n = pread(fd, buf + got, len - got, off + (off_t)got);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        if (n == 0)
+        {
+            break;
+        }
+        got += (size_t)n;
+    }
+    return (ssize_t)got;
+}
+
+// Load the lines owned by shard i (those whose first byte lies in its
+// nominal range) into *buf. Sets *data/*len to them and *offset to where
+// they start in the file; returns -1 on error
+static int loadShard(shard_pool *pool, size_t i, char **buf, size_t *cap, const char **data, size_t *len,
+                     off_t *offset)
+{
+    off_t start = (off_t)i * PB_SHARD_BYTES;
+    off_t end = start + PB_SHARD_BYTES < pool->size ? start + PB_SHARD_BYTES : pool->size;
+    off_t from = start > 0 ? start - 1 : 0; // One byte back tells if start is a line start
+
+    size_t want = (size_t)(end - from);
+    if (want > *cap)
+    {
+        char *grown = realloc(*buf, want);
+        if (grown == NULL)
+        {
+            return -1;
+        }
+        *buf = grown;
+        *cap = want;
+    }
+    ssize_t n = readAt(pool->fd, *buf, want, from);
+    if (n < 0)
+    {
+        return -1;
+    }
+    size_t filled = (size_t)n;
+
+    // Finish the line that crosses the end of the nominal range
+    const char *tail = memchr(*buf + (size_t)(end - from) - 1, '\n', 1);
+    while (tail == NULL && from + (off_t)filled < pool->size)
+    {
+        if (filled + SHARD_EXTEND > *cap)
+        {
+            char *grown = realloc(*buf, *cap + SHARD_EXTEND);
+            if (grown == NULL)
+            {
+                return -1;
+            }
+            *buf = grown;
+            *cap += SHARD_EXTEND;
+        }
+        n = readAt(pool->fd, *buf + filled, SHARD_EXTEND, from + (off_t)filled);
+        if (n <= 0)
+        {
+            break;
+        }
+        tail = memchr(*buf + filled, '\n', (size_t)n);
+        filled += (size_t)n;
+    }
+    const char *stop = tail != NULL ? tail + 1 : *buf + filled;
+
+    // Skip the partial line owned by the previous shard
+    const char *first = *buf;
+    if (start > 0)
+    {
+        first = memchr(*buf, '\n', (size_t)(stop - *buf));
+        first = first != NULL ? first + 1 : stop;
+    }
+
+    *data = first;
+    *len = (size_t)(stop - first);
+    *offset = from + (first - *buf);
+    return 0;
+}
+
+static void *worker(void *arg)
+{
+    shard_pool *pool = arg;
+    char *buf = NULL;
+    size_t cap = 0;
+
+    while (1)
+    {
+        pthread_mutex_lock(&pool->lock);
+        while (pool->next < pool->nshards && pool->next >= pool->emitted + pool->window && !pool->failed)
+        {
+            pthread_cond_wait(&pool->changed, &pool->lock);
+        }
+        if (pool->next >= pool->nshards || pool->failed)
+        {
+            pthread_mutex_unlock(&pool->lock);
+            break;
+        }
+        size_t i = pool->next++;
+        pthread_mutex_unlock(&pool->lock);
+
+        const char *data;
+        size_t len;
+        off_t offset;
+        char *result = NULL;
+        size_t resultLen = 0;
+        size_t found = 0;
+        int ok = loadShard(pool, i, &buf, &cap, &data, &len, &offset) == 0;
+        FILE *out = ok ? open_memstream(&result, &resultLen) : NULL;
+        if (out != NULL)
+        {
+            found = pool->fn(data, len, offset, pool->ctx, out);
+            ok = fclose(out) == 0;
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        if (!ok || out == NULL)
+        {
+            pool->failed = 1;
+        }
+        pool->results[i] = result;
+        pool->lengths[i] = resultLen;
+        pool->done[i] = 1;
+        pool->matches += (long)found;
+        pthread_cond_broadcast(&pool->changed);
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    free(buf);
+    return NULL;
+}
+
+long pb_parallel_scan(int fd, size_t threads, pb_shard_fn fn, void *ctx, FILE *out)
+{
+    struct stat st;
+    if (fstat(fd, &st) == -1)
+    {
+        return -1;
+    }
+    if (threads == 0)
+    {
+        threads = 1;
+    }
+
+    shard_pool pool;
+    memset(&pool, 0, sizeof(pool));
+    pool.fd = fd;
+    pool.size = st.st_size;
+    pool.nshards = (size_t)((st.st_size + PB_SHARD_BYTES - 1) / PB_SHARD_BYTES);
+    pool.fn = fn;
+    pool.ctx = ctx;
+    pool.window = threads * WINDOW_PER_THREAD;
+    pool.results = calloc(pool.nshards + 1, sizeof(*pool.results));
+    pool.lengths = calloc(pool.nshards + 1, sizeof(*pool.lengths));
+    pool.done = calloc(pool.nshards + 1, 1);
+    pthread_t *tids = calloc(threads, sizeof(*tids));
+    if (pool.results == NULL || pool.lengths == NULL || pool.done == NULL || tids == NULL)
+    {
+        free(pool.results);
+        free(pool.lengths);
+        free(pool.done);
+        free(tids);
+        errno = ENOMEM;
+        return -1;
+    }
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.changed, NULL);
+
+    size_t started = 0;
+    while (started < threads && started < pool.nshards &&
+           pthread_create(&tids[started], NULL, worker, &pool) == 0)
+    {
+        started++;
+    }
+    if (started == 0 && pool.nshards > 0)
+    {
+        pool.failed = 1;
+    }
+
+    // Write finished shards strictly in file order
+    for (size_t i = 0; i < pool.nshards; i++)
+    {
+        pthread_mutex_lock(&pool.lock);
+        while (!pool.done[i] && !pool.failed)
+        {
+            pthread_cond_wait(&pool.changed, &pool.lock);
+        }
+        if (!pool.done[i])
+        {
+            pthread_mutex_unlock(&pool.lock);
+            break;
+        }
+        char *result = pool.results[i];
+        size_t len = pool.lengths[i];
+        pool.results[i] = NULL;
+        pool.emitted = i + 1;
+        pthread_cond_broadcast(&pool.changed);
+        pthread_mutex_unlock(&pool.lock);
+
+        fwrite(result, 1, len, out);
+        free(result);
+    }
+
+    for (size_t t = 0; t < started; t++)
+    {
+        pthread_join(tids[t], NULL);
+    }
+    for (size_t i = 0; i < pool.nshards; i++)
+    {
+        free(pool.results[i]);
+    }
+
+    long matches = pool.failed ? -1 : pool.matches;
+    pthread_mutex_destroy(&pool.lock);
+    pthread_cond_destroy(&pool.changed);
+    free(pool.results);
+    free(pool.lengths);
+    free(pool.done);
+    free(tids);
+    return matches;
+}
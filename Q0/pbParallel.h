@@ -0,0 +1,22 @@
+#ifndef PB_PARALLEL_H
+#define PB_PARALLEL_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+// Nominal size of one shard; real shards are widened to whole lines
+#define PB_SHARD_BYTES (32 << 20)
+
+// Scan a buffer of complete lines, which start at offset in the file,
+// writing results to out. Returns the number of matches
+typedef size_t (*pb_shard_fn)(const char *data, size_t n, off_t offset, void *ctx, FILE *out);
+
+// Split the file into newline-aligned shards and scan them on `threads`
+// worker threads. Every shard's output is buffered and written to out in
+// file order; only a bounded window of shards is in flight at a time, so
+// memory use does not grow with the file size.
+// Returns the number of matches, or -1 on error
+long pb_parallel_scan(int fd, size_t threads, pb_shard_fn fn, void *ctx, FILE *out);
+
+#endif
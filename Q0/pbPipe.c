@@ -0,0 +1,268 @@
+#define _GNU_SOURCE
+#include "pbPipe.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define COPY_BYTES (64 << 10) // Buffer for the read/write fallback
+
+extern char **environ;
+
+// Write all of buf, retrying short writes. Returns -1 on error
+static int writeAll(int fd, const char *buf, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+// Move everything from in into the first stage's pipe. splice hands the
+// page cache pages to the pipe; files it cannot handle fall back to copies.
+// A stage that stops reading early (EPIPE) is not an error
+static int feed(int in, int pipeFd)
+{
+    char *buf = NULL;
+    int result = 0;
+
+    while (1)
+    {
+        ssize_t n;
+        if (buf == NULL)
+        {
+            n = splice(in, NULL, pipeFd, NULL, PB_PIPE_BYTES, SPLICE_F_MOVE | SPLICE_F_MORE);
+            if (n < 0 && (errno == EINVAL || errno == ENOSYS))
+            {
+                buf = malloc(COPY_BYTES);
+                if (buf == NULL)
+                {
+                    return -1;
+                }
+                continue;
+            }
+        }
+        else
+        {
+            n = read(in, buf, COPY_BYTES);
+            if (n > 0 && writeAll(pipeFd, buf, (size_t)n) == -1)
+            {
+                n = -1;
+            }
+        }
+
+        if (n == 0)
+        {
+            break;
+        }
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno != EPIPE)
+            {
+                result = -1;
+            }
+            break;
+        }
+    }
+
+    free(buf);
+    return result;
+}
+
+// Fork a stage that runs a function of this process. Returns its pid or -1
+static pid_t forkStage(const pb_stage *stage, int stdinFd, int stdoutFd)
+{
+    pid_t pid = fork();
+    if (pid != 0)
+    {
+        return pid;
+    }
+
+    signal(SIGPIPE, SIG_DFL);
+    if ((stdinFd != -1 && stdinFd != STDIN_FILENO && dup2(stdinFd, STDIN_FILENO) == -1) ||
+        (stdoutFd != STDOUT_FILENO && dup2(stdoutFd, STDOUT_FILENO) == -1))
+    {
+        _exit(127);
+    }
+    // Without an exec nothing closes the other pipe ends, and a write end
+    // left open here would keep an earlier stage from ever seeing EOF
+    close_range(3, ~0U, 0);
+    int status = stage->fn(stage->arg);
+    _exit(fflush(stdout) == 0 ? status : 1);
+}
+
+// Start one stage with the given stdin/stdout. Returns its pid or -1
+static pid_t spawnStage(const pb_stage *stage, int stdinFd, int stdoutFd)
+{
+    if (stage->argv == NULL)
+    {
+        return forkStage(stage, stdinFd, stdoutFd);
+    }
+
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawnattr_init(&attr);
+
+    // Every pipe end is close-on-exec; dup2 clears the flag on the copies
+    if (stdinFd != -1 && stdinFd != STDIN_FILENO)
+    {
+        posix_spawn_file_actions_adddup2(&actions, stdinFd, STDIN_FILENO);
+    }
+    if (stdoutFd != STDOUT_FILENO)
+    {
+        posix_spawn_file_actions_adddup2(&actions, stdoutFd, STDOUT_FILENO);
+    }
+
+    // The parent ignores SIGPIPE while feeding; the filters must not
+    sigset_t defaults;
+    sigemptyset(&defaults);
+    sigaddset(&defaults, SIGPIPE);
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+    short flags = POSIX_SPAWN_SETSIGDEF;
+#ifdef POSIX_SPAWN_USEVFORK
+    flags |= POSIX_SPAWN_USEVFORK;
+#endif
+    posix_spawnattr_setflags(&attr, flags);
+
+    pid_t pid;
+    int err = posix_spawnp(&pid, stage->argv[0], &actions, &attr, stage->argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    if (err != 0)
+    {
+        errno = err;
+        return -1;
+    }
+    return pid;
+}
+
+int pb_pipeline_run(const pb_stage *stages, size_t count, int in, int out)
+{
+    if (count == 0)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    pid_t *pids = calloc(count, sizeof(*pids));
+    if (pids == NULL)
+    {
+        return -1;
+    }
+
+    int feedFd = -1;  // Write end of the first stage's stdin, when we feed it
+    int stdinFd = -1; // Read end waiting for the next stage
+    if (in != -1)
+    {
+        int fds[2];
+        if (pipe2(fds, O_CLOEXEC) == -1)
+        {
+            free(pids);
+            return -1;
+        }
+        fcntl(fds[1], F_SETPIPE_SZ, PB_PIPE_BYTES);
+        stdinFd = fds[0];
+        feedFd = fds[1];
+    }
+
+    size_t started = 0;
+    int failed = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        int fds[2] = {-1, -1};
+        int stdoutFd = out;
+        if (i + 1 < count)
+        {
+            if (pipe2(fds, O_CLOEXEC) == -1)
+            {
+                failed = 1;
+                break;
+            }
+            fcntl(fds[1], F_SETPIPE_SZ, PB_PIPE_BYTES);
+            stdoutFd = fds[1];
+        }
+
+        pids[i] = spawnStage(&stages[i], stdinFd, stdoutFd);
+
+        // Only the children keep their ends, so every reader sees EOF
+        // once its writer exits
+        if (stdinFd != -1)
+        {
+            close(stdinFd);
+        }
+        if (fds[1] != -1)
+        {
+            close(fds[1]);
+        }
+        stdinFd = fds[0];
+        if (pids[i] == -1)
+        {
+            failed = 1;
+            break;
+        }
+        started++;
+    }
+    if (stdinFd != -1)
+    {
+        close(stdinFd);
+    }
+
+    int saved = errno;
+    if (feedFd != -1)
+    {
+        if (!failed)
+        {
+            struct sigaction ignore, previous;
+            memset(&ignore, 0, sizeof(ignore));
+            ignore.sa_handler = SIG_IGN;
+            sigaction(SIGPIPE, &ignore, &previous);
+            if (feed(in, feedFd) == -1)
+            {
+                failed = 1;
+                saved = errno;
+            }
+            sigaction(SIGPIPE, &previous, NULL);
+        }
+        close(feedFd);
+    }
+
+    // Wait for every stage; the pipeline's status is the last one's
+    int status = 0;
+    for (size_t i = 0; i < started; i++)
+    {
+        while (waitpid(pids[i], &status, 0) == -1 && errno == EINTR)
+        {
+            // Interrupted by a signal; keep waiting
+        }
+    }
+    free(pids);
+
+    if (failed)
+    {
+        errno = saved;
+        return -1;
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
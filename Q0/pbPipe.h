@@ -0,0 +1,27 @@
+#ifndef PB_PIPE_H
+#define PB_PIPE_H
+
+#include <stddef.h>
+
+// Capacity requested for every pipe between stages
+#define PB_PIPE_BYTES (1 << 20)
+
+// One process of a pipeline: a program, argv[0] looked up in PATH, or if
+// argv is NULL a fork of this process that runs fn(arg) between the pipes
+// and exits with what it returns (stdout flushed)
+typedef struct
+{
+    char *const *argv;
+    int (*fn)(void *arg);
+    void *arg;
+} pb_stage;
+
+// Run the stages with one pipe per boundary, each stage's stdout feeding
+// the next one's stdin. Children are started with posix_spawn. If in is not
+// -1 the parent feeds it to the first stage, with splice when the kernel
+// allows it (no copy through user space); otherwise the first stage
+// inherits stdin. The last stage writes to out.
+// Returns the exit status of the last stage, or -1 on error
+int pb_pipeline_run(const pb_stage *stages, size_t count, int in, int out);
+
+#endif
@@ -0,0 +1,258 @@
+#define _GNU_SOURCE
+#include "pbScan.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PB_SCAN_X86 1
+#endif
+
+// Plain C search: jump between occurrences of the first byte with memchr
+static const char *find_scalar(const char *hay, size_t n, const char *needle, size_t k)
+{
+    const char *end = hay + n;
+    const char *p = hay;
+    while ((size_t)(end - p) >= k)
+    {
+        p = memchr(p, needle[0], (size_t)(end - p) - k + 1);
+        if (p == NULL)
+        {
+            return NULL;
+        }
+        if (memcmp(p + 1, needle + 1, k - 1) == 0)
+        {
+            return p;
+        }
+        p++;
+    }
+    return NULL;
+}
+
+#ifdef PB_SCAN_X86
+// Candidate filtering: a position can only match if both the first and the
+// last byte of the needle line up, so compare a whole vector of positions
+// against both at once and verify only the survivors
+static const char *find_sse2(const char *hay, size_t n, const char *needle, size_t k)
+{
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[k - 1]);
+    size_t i = 0;
+
+    for (; i + k - 1 + 16 <= n; i += 16)
+    {
+        __m128i blockFirst = _mm_loadu_si128((const __m128i *)(hay + i));
+        __m128i blockLast = _mm_loadu_si128((const __m128i *)(hay + i + k - 1));
+        unsigned mask = (unsigned)_mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(first, blockFirst), _mm_cmpeq_epi8(last, blockLast)));
+
+        while (mask != 0)
+        {
+            unsigned bit = (unsigned)__builtin_ctz(mask);
+            if (memcmp(hay + i + bit + 1, needle + 1, k - 2) == 0)
+            {
+                return hay + i + bit;
+            }
+            mask &= mask - 1;
+        }
+    }
+    return find_scalar(hay + i, n - i, needle, k);
+}
+
+__attribute__((target("avx2")))
+static const char *find_avx2(const char *hay, size_t n, const char *needle, size_t k)
+{
+    const __m256i first = _mm256_set1_epi8(needle[0]);
+    const __m256i last = _mm256_set1_epi8(needle[k - 1]);
+    size_t i = 0;
+
+    for (; i + k - 1 + 32 <= n; i += 32)
+    {
+        __m256i blockFirst = _mm256_loadu_si256((const __m256i *)(hay + i));
+        __m256i blockLast = _mm256_loadu_si256((const __m256i *)(hay + i + k - 1));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(
+            _mm256_and_si256(_mm256_cmpeq_epi8(first, blockFirst), _mm256_cmpeq_epi8(last, blockLast)));
+
+        while (mask != 0)
+        {
+            unsigned bit = (unsigned)__builtin_ctz(mask);
+            if (memcmp(hay + i + bit + 1, needle + 1, k - 2) == 0)
+            {
+                return hay + i + bit;
+            }
+            mask &= mask - 1;
+        }
+    }
+    return find_scalar(hay + i, n - i, needle, k);
+}
+#endif
+
+// One-byte needles are a plain memchr
+static const char *find_byte(const char *hay, size_t n, const char *needle, size_t k)
+{
+    (void)k;
+    return memchr(hay, needle[0], n);
+}
+
+// The empty pattern matches every line, like grep ''
+static const char *find_empty(const char *hay, size_t n, const char *needle, size_t k)
+{
+    (void)n;
+    (void)needle;
+    (void)k;
+    return hay;
+}
+
+int pb_scanner_init(pb_scanner *sc, const char *pattern, size_t len, const char *impl)
+{
+    sc->pattern = pattern;
+    sc->len = len;
+    sc->find = find_scalar;
+    sc->impl = "scalar";
+
+#ifdef PB_SCAN_X86
+    __builtin_cpu_init();
+    int avx2 = __builtin_cpu_supports("avx2");
+    if (impl == NULL ? avx2 : strcmp(impl, "avx2") == 0)
+    {
+        if (!avx2)
+        {
+            return -1;
+        }
+        sc->find = find_avx2;
+        sc->impl = "avx2";
+    }
+    else if (impl == NULL || strcmp(impl, "sse2") == 0)
+    {
+        sc->find = find_sse2;
+        sc->impl = "sse2";
+    }
+    else if (strcmp(impl, "scalar") != 0)
+    {
+        return -1;
+    }
+#else
+    if (impl != NULL && strcmp(impl, "scalar") != 0)
+    {
+        return -1;
+    }
+#endif
+
+    // Vector filtering needs distinct first and last positions
+    if (len == 0)
+    {
+        sc->find = find_empty;
+    }
+    else if (len == 1)
+    {
+        sc->find = find_byte;
+    }
+    return 0;
+}
+
+size_t pb_scan_buffer(const pb_scanner *sc, const char *data, size_t n, pb_line_fn fn, void *arg)
+{
+    const char *p = data;
+    const char *end = data + n;
+    size_t matches = 0;
+
+    while (p < end)
+    {
+        const char *hit = sc->find(p, (size_t)(end - p), sc->pattern, sc->len);
+        if (hit == NULL)
+        {
+            break;
+        }
+
+        // Widen the hit to its line; p always sits at a line start
+        const char *nl = memrchr(p, '\n', (size_t)(hit - p));
+        const char *line = nl != NULL ? nl + 1 : p;
+        const char *eol = pb_line_end(hit, end);
+
+        fn(line, eol, arg);
+        matches++;
+        p = eol + 1;
+    }
+    return matches;
+}
+
+long pb_stream_chunks(int fd, pb_chunk_fn fn, void *ctx)
+{
+    char *buffer = malloc(PB_SCAN_CHUNK);
+    if (buffer == NULL)
+    {
+        return -1;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    size_t cap = PB_SCAN_CHUNK;
+    size_t carry = 0; // Partial last line kept from the previous chunk
+    long matches = 0;
+
+    while (1)
+    {
+        if (carry == cap)
+        {
+            // A single line longer than the buffer
+            char *bigger = realloc(buffer, cap * 2);
+            if (bigger == NULL)
+            {
+                free(buffer);
+                return -1;
+            }
+            buffer = bigger;
+            cap *= 2;
+        }
+
+        ssize_t n = read(fd, buffer + carry, cap - carry);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            free(buffer);
+            return -1;
+        }
+        if (n == 0)
+        {
+            matches += (long)fn(buffer, carry, ctx);
+            break;
+        }
+
+        size_t filled = carry + (size_t)n;
+        const char *last = memrchr(buffer, '\n', filled);
+        size_t complete = last != NULL ? (size_t)(last - buffer) + 1 : 0;
+
+        matches += (long)fn(buffer, complete, ctx);
+        carry = filled - complete;
+        memmove(buffer, buffer + complete, carry);
+    }
+
+    free(buffer);
+    return matches;
+}
+
+// Arguments of pb_scan_buffer bundled for pb_stream_chunks
+typedef struct
+{
+    const pb_scanner *sc;
+    pb_line_fn fn;
+    void *arg;
+} scan_job;
+
+static size_t scan_chunk(const char *data, size_t n, void *ctx)
+{
+    const scan_job *job = ctx;
+    return pb_scan_buffer(job->sc, data, n, job->fn, job->arg);
+}
+
+long pb_scan_fd(const pb_scanner *sc, int fd, pb_line_fn fn, void *arg)
+{
+    scan_job job = {sc, fn, arg};
+    return pb_stream_chunks(fd, scan_chunk, &job);
+}
@@ -0,0 +1,40 @@
+#ifndef PB_SCAN_H
+#define PB_SCAN_H
+
+#include "pbFile.h"
+
+// Bytes read from the phone book per chunk when streaming
+#define PB_SCAN_CHUNK (4 << 20)
+
+// Find the first occurrence of needle[0..k) in hay[0..n), or NULL
+typedef const char *(*pb_find_fn)(const char *hay, size_t n, const char *needle, size_t k);
+
+// Fixed-string line matcher with a search routine picked for this CPU
+typedef struct
+{
+    const char *pattern;
+    size_t len;
+    pb_find_fn find;
+    const char *impl; // "avx2", "sse2" or "scalar"
+} pb_scanner;
+
+// Prepare a scanner. impl selects an implementation by name, or NULL for
+// the fastest one the CPU supports. Returns -1 if impl is not available
+int pb_scanner_init(pb_scanner *sc, const char *pattern, size_t len, const char *impl);
+
+// Call fn for every line of data[0..n) that contains the pattern, in order.
+// A final line without '\n' counts as a line. Returns the number of matches
+size_t pb_scan_buffer(const pb_scanner *sc, const char *data, size_t n, pb_line_fn fn, void *arg);
+
+// Called with a buffer holding only complete lines; returns the matches found
+typedef size_t (*pb_chunk_fn)(const char *data, size_t n, void *ctx);
+
+// Read a file in PB_SCAN_CHUNK pieces and hand every run of complete lines
+// to fn. Returns the total fn reported, or -1 on a read error
+long pb_stream_chunks(int fd, pb_chunk_fn fn, void *ctx);
+
+// Stream a file through the scanner in PB_SCAN_CHUNK reads.
+// Returns the number of matching lines, or -1 on a read error
+long pb_scan_fd(const pb_scanner *sc, int fd, pb_line_fn fn, void *arg);
+
+#endif
@@ -0,0 +1,109 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "pbScan.h"
+
+// Count matches without printing, so only the scan itself is timed
+static void countMatch(const char *line, const char *end, void *arg)
+{
+    (void)line;
+    (void)end;
+    (*(unsigned long long *)arg)++;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Time one in-process scan of the file with the given implementation
+static void benchScanner(const char *file, const char *pattern, const char *impl, double size)
+{
+    pb_scanner scanner;
+    if (pb_scanner_init(&scanner, pattern, strlen(pattern), impl) == -1)
+    {
+        printf("%-10s %-24s %12s\n", impl, pattern, "unsupported");
+        return;
+    }
+
+    int fd = open(file, O_RDONLY);
+    if (fd == -1)
+    {
+        perror(file);
+        exit(EXIT_FAILURE);
+    }
+    unsigned long long matches = 0;
+    double start = now();
+    pb_scan_fd(&scanner, fd, countMatch, &matches);
+    double elapsed = now() - start;
+    close(fd);
+
+    printf("%-10s %-24s %10.3f s %10.1f MB/s %10llu matches\n",
+           impl, pattern, elapsed, size / elapsed / 1e6, matches);
+}
+
+// Time a findPhone process (pipeline or -s mode) with its output discarded
+static void benchProcess(const char *label, const char *file, const char *pattern, const char *mode, double size)
+{
+    double start = now();
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        int devnull = open("/dev/null", O_WRONLY);
+        dup2(devnull, STDOUT_FILENO);
+        if (mode != NULL)
+        {
+            execl("./findPhone", "findPhone", "-f", file, mode, pattern, NULL);
+        }
+        else
+        {
+            execl("./findPhone", "findPhone", "-f", file, pattern, NULL);
+        }
+        perror("findPhone");
+        _exit(EXIT_FAILURE);
+    }
+    waitpid(pid, NULL, 0);
+    double elapsed = now() - start;
+
+    printf("%-10s %-24s %10.3f s %10.1f MB/s\n", label, pattern, elapsed, size / elapsed / 1e6);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 3)
+    {
+        fprintf(stderr, "Usage: %s <phoneBook> <pattern>...\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    struct stat st;
+    if (stat(argv[1], &st) == -1)
+    {
+        perror(argv[1]);
+        return EXIT_FAILURE;
+    }
+    double size = (double)st.st_size;
+    printf("Scanning %s (%.1f MB), warm page cache\n", argv[1], size / 1e6);
+
+    static const char *IMPLS[] = {"scalar", "sse2", "avx2"};
+    for (int p = 2; p < argc; p++)
+    {
+        // First pass only warms the page cache
+        benchScanner(argv[1], argv[p], "scalar", size);
+        for (size_t i = 0; i < sizeof(IMPLS) / sizeof(IMPLS[0]); i++)
+        {
+            benchScanner(argv[1], argv[p], IMPLS[i], size);
+        }
+        benchProcess("findPhone", argv[1], argv[p], "-s", size);
+        benchProcess("pipeline", argv[1], argv[p], NULL, size);
+    }
+    return EXIT_SUCCESS;
+}
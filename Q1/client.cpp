@@ -3,13 +3,37 @@
 #include <string>
 #include <unistd.h>
 #include <arpa/inet.h>
+#include "binaryProtocol.h"
 
-int main() {
+// Read exactly size bytes from the socket
+bool readFully(int sock, char* buffer, size_t size) {
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = read(sock, buffer + done, size - done);
+        if (n <= 0) return false;
+        done += n;
+    }
+    return true;
+}
+
+int main(int argc, char* argv[]) {
     const char* SERVER_IP = "127.0.0.1";  // Server IP address (localhost)
     const int PORT = 8080;  // Port to connect to the server
     int sock = 0;  // Socket file descriptor
     struct sockaddr_in serv_addr;  // Server address structure
     char buffer[1024] = {0};  // Buffer to receive server response
+    bool binary = false;  // Speak the binary protocol instead of text commands
+    uint32_t request_id = 0;  // Id of the last binary request
+
+    // Parse command-line options
+    int opt;
+    while ((opt = getopt(argc, argv, "b")) != -1) {
+        if (opt != 'b') {
+            std::cerr << "Usage: " << argv[0] << " [-b]" << std::endl;
+            return -1;
+        }
+        binary = true;
+    }
 
     // Create socket
     if ((sock = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
@@ -33,6 +57,15 @@ int main() {
         return -1;  // Return on error
     }
 
+    // Negotiate the binary protocol: the server echoes the hello byte
+    if (binary) {
+        char hello = (char)PROTOCOL_HELLO;
+        if (send(sock, &hello, 1, 0) != 1 || !readFully(sock, &hello, 1) || (uint8_t)hello != PROTOCOL_HELLO) {
+            std::cerr << "Server does not support the binary protocol\n";
+            return -1;
+        }
+    }
+
     // Main loop to interact with the server
     while (true) {
         std::string command;
@@ -42,6 +75,21 @@ int main() {
         // Exit the loop if user types "exit"
         if (command == "exit") break;
 
+        // Send the command as a frame and print the decoded response
+        if (binary) {
+            Frame frame;
+            if (!commandToFrame(command, ++request_id, frame)) {
+                std::cout << "Invalid command" << std::endl;
+                continue;
+            }
+            std::string request;
+            appendFrame(request, frame);
+            send(sock, request.data(), request.size(), 0);
+            if (!readFully(sock, buffer, FRAME_SIZE)) break;
+            std::cout << "Server response: " << describeFrame(decodeFrame(buffer)) << std::endl;
+            continue;
+        }
+
         // Append CRLF to the command
         command += "\r\n";
         // Send the command to the server
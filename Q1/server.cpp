@@ -1,34 +1,111 @@
 #include <iostream>
 #include <cstring>
 #include <string>
-#include <sstream>
 #include <unistd.h>
 #include <netinet/in.h>
 #include <vector>
+#include <cerrno>
+#include <fcntl.h>
 #include <sys/select.h>
+#include <sys/epoll.h>
+#include <climits>
+#include <algorithm>
+#include <csignal>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <pthread.h>
+#include <sched.h>
+#include "ioUring.h"
+#include "commandParser.h"
+#include "binaryProtocol.h"
+#include "logger.h"
 
 // Constants and Global Variables
 const unsigned long long MAX_ATOMS = 1000000000000000000;  // Maximum allowed atoms for each element (change to unsigned int)
-unsigned long long carbon_atoms = 0;  // Counter for CARBON atoms
-unsigned long long oxygen_atoms = 0;  // Counter for OXYGEN atoms
-unsigned long long hydrogen_atoms = 0;  // Counter for HYDROGEN atoms
 
 /**
- * Parse the command string to extract atom type and count.
- * @param command The input command string.
- * @param atom The type of atom to be added (e.g., "CARBON", "OXYGEN", "HYDROGEN").
- * @param count The number of atoms to add.
- * @return True if the command is valid, false otherwise.
+ * Atoms added through one shard (event-loop thread). Only the owning thread
+ * writes its counters; every limit check merges the counters of all shards,
+ * so the atom totals stay global while the hot path touches no shared line.
  */
-bool parseCommand(const std::string& command, std::string& atom, unsigned int& count) {
-    std::istringstream iss(command);
-    std::string add;
-    if (!(iss >> add >> atom >> count) || add != "ADD") {
-        return false;  // Invalid command or wrong format
+struct ShardCounters {
+    std::atomic<unsigned long long> atoms[ATOM_TYPES];
+    std::atomic<bool> in_fast_path;  // Between the limit check and the update
+    char padding[64];  // Keep shards on separate cache lines
+};
+
+ShardCounters* shards = nullptr;  // One per event-loop thread
+unsigned shard_count = 1;
+thread_local unsigned current_shard = 0;  // Shard of the calling thread
+
+std::atomic<bool> exact_mode(false);  // Set for good once any total nears MAX_ATOMS
+std::mutex limit_lock;  // Serializes the exact limit checks
+
+const size_t MAX_COMMAND_LENGTH = 4096;  // Longest command line accepted
+const size_t OUTPUT_HIGH_WATER = 262144;  // Queued output that pauses reading from a client
+
+// A client connection: the bytes received after its last complete command
+// and the responses its socket has not taken yet
+struct Connection {
+    int fd;
+    std::string input;
+    unsigned protocol;   // Protocol, decided by the first byte received
+    std::string output;  // Responses waiting for the socket to become writable
+    bool closing;        // Drop the client once output is written
+};
+
+/**
+ * Sum the counters of one atom type over all shards.
+ */
+unsigned long long totalAtoms(Atom atom) {
+    unsigned long long total = 0;
+    for (unsigned i = 0; i < shard_count; i++) {
+        total += shards[i].atoms[atom].load();
     }
-    if (atom != "CARBON" && atom != "OXYGEN" && atom != "HYDROGEN") {
-        return false;  // Invalid atom type
+    return total;
+}
+
+/**
+ * Add atoms through the calling thread's shard unless the merged total
+ * would pass MAX_ATOMS.
+ * A merged total read by one shard can miss at most one command in flight
+ * on each other shard, so far from the limit a check with that margin is
+ * enough. Near the limit the fast path is switched off and the exact total
+ * is checked under a lock once every other shard has left its fast path.
+ * @param total Receives the merged total after the command.
+ * @return True if the atoms were added.
+ */
+bool addAtoms(Atom atom, unsigned int count, unsigned long long& total) {
+    ShardCounters& own = shards[current_shard];
+    const unsigned long long in_flight = (unsigned long long)(shard_count - 1) * UINT_MAX;
+
+    own.in_fast_path.store(true);
+    if (!exact_mode.load()) {
+        unsigned long long seen = totalAtoms(atom);
+        if (seen + in_flight + count <= MAX_ATOMS) {
+            own.atoms[atom].store(own.atoms[atom].load(std::memory_order_relaxed) + count);
+            own.in_fast_path.store(false);
+            total = seen + count;
+            return true;
+        }
+    }
+    own.in_fast_path.store(false);
+
+    std::lock_guard<std::mutex> guard(limit_lock);
+    exact_mode.store(true);
+    for (unsigned i = 0; i < shard_count; i++) {
+        while (shards[i].in_fast_path.load()) {
+            std::this_thread::yield();
+        }
     }
+
+    total = totalAtoms(atom);
+    if (total + count > MAX_ATOMS) {
+        return false;
+    }
+    own.atoms[atom].store(own.atoms[atom].load(std::memory_order_relaxed) + count);
+    total += count;
     return true;
 }
 
@@ -37,145 +114,469 @@ bool parseCommand(const std::string& command, std::string& atom, unsigned int& c
  * @param command The input command string.
  * @return A response string indicating the result of the command.
  */
-std::string processCommand(const std::string& command) {
-    std::string atom;
+std::string processCommand(std::string_view command) {
+    Atom atom;
     unsigned int count;
 
     // Parse the command and check its validity
-    if (!parseCommand(command, atom, count)) {
-        std::cout << "Invalid command received: " << command << std::endl;
+    if (!parseAddCommand(command, atom, count)) {
+        LOG_WARN("Invalid command received: " << command);
         return "invalid command";  // Invalid command format
     }
 
     // Handle atom addition and check for overflow
-    if (atom == "CARBON") {
-        if (carbon_atoms + count > MAX_ATOMS) {
-            std::cout << "Too many CARBON atoms. Current: " << carbon_atoms << ", Attempted to add: " << count << std::endl;
-            return "carbon atoms limit exceeded";
-        }
-        carbon_atoms += count;
-        std::cout << "Added " << count << " CARBON atoms. Total: " << carbon_atoms << std::endl;
-    } else if (atom == "OXYGEN") {
-        if (oxygen_atoms + count > MAX_ATOMS) {
-            std::cout << "Too many OXYGEN atoms. Current: " << oxygen_atoms << ", Attempted to add: " << count << std::endl;
-            return "oxygen atoms limit exceeded";
-        }
-        oxygen_atoms += count;
-        std::cout << "Added " << count << " OXYGEN atoms. Total: " << oxygen_atoms << std::endl;
-    } else if (atom == "HYDROGEN") {
-        if (hydrogen_atoms + count > MAX_ATOMS) {
-            std::cout << "Too many HYDROGEN atoms. Current: " << hydrogen_atoms << ", Attempted to add: " << count << std::endl;
-            return "hydrogen atoms limit exceeded";
-        }
-        hydrogen_atoms += count;
-        std::cout << "Added " << count << " HYDROGEN atoms. Total: " << hydrogen_atoms << std::endl;
+    std::string_view name = ATOM_NAMES[atom];
+    unsigned long long total;
+    if (!addAtoms(atom, count, total)) {
+        LOG_WARN("Too many " << name << " atoms. Current: " << total << ", Attempted to add: " << count);
+        std::string lower(name);
+        std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+        return lower + " atoms limit exceeded";
     }
+    LOG_INFO("Added " << count << " " << name << " atoms. Total: " << total);
 
     // Return success message
-    return "added " + std::to_string(count) + " " + atom + " atoms";
+    std::string response = "added " + std::to_string(count) + " ";
+    response.append(name);
+    return response + " atoms";
 }
 
-int main() {
-    // Network initialization
-    const int PORT = 8080;  // Port to listen on
+/**
+ * Execute one binary request frame.
+ * @return The response frame.
+ */
+Frame processFrame(const Frame& request) {
+    Frame response = request;
+    unsigned long long total;
+    if (request.opcode != OPCODE_ADD) {
+        response.status = request.opcode == OPCODE_DELIVER || request.opcode == OPCODE_GEN ? STATUS_UNSUPPORTED
+                                                                                          : STATUS_INVALID;
+    }
+    else if (request.id >= ATOM_TYPES || request.count > UINT_MAX) {
+        response.status = STATUS_INVALID;
+    }
+    else {
+        bool added = addAtoms((Atom)request.id, (unsigned int)request.count, total);
+        response.status = added ? STATUS_OK : STATUS_LIMIT;
+    }
+    return response;
+}
+
+/**
+ * Create the listening socket on the given port.
+ * @param port The TCP port to listen on.
+ * @return The listening socket (exits the program on failure).
+ */
+int createServerSocket(int port) {
     int server_fd;  // Server socket file descriptor
     struct sockaddr_in address;  // Socket address structure
     int opt = 1;  // Option to reuse address
-    int addrlen = sizeof(address);  // Length of address structure
 
     // Create socket
-    if ((server_fd = socket(AF_INET, SOCK_STREAM, 0)) == 0) {
+    if ((server_fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
         perror("socket failed");
         exit(EXIT_FAILURE);
     }
 
-    // Set socket options
-    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR | SO_REUSEPORT, &opt, sizeof(opt))) {
+    // Set socket options; with SO_REUSEPORT every shard binds its own
+    // listening socket to the port and the kernel spreads connections
+    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) ||
+        setsockopt(server_fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt))) {
         perror("setsockopt");
         exit(EXIT_FAILURE);
     }
 
     // Bind socket to address
+    memset(&address, 0, sizeof(address));
     address.sin_family = AF_INET;
     address.sin_addr.s_addr = INADDR_ANY;
-    address.sin_port = htons(PORT);
+    address.sin_port = htons(port);
     if (bind(server_fd, (struct sockaddr*)&address, sizeof(address)) < 0) {
         perror("bind failed");
         exit(EXIT_FAILURE);
     }
 
     // Listen for incoming connections
-    if (listen(server_fd, 3) < 0) {
+    if (listen(server_fd, SOMAXCONN) < 0) {
         perror("listen");
         exit(EXIT_FAILURE);
     }
+    return server_fd;
+}
+
+/**
+ * Switch a socket to non-blocking mode.
+ * @return True on success.
+ */
+bool setNonBlocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags != -1 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) != -1;
+}
+
+/**
+ * Write as much of a connection's queued output as its non-blocking socket
+ * takes now; the rest waits until the socket is writable again.
+ * @return False if the connection failed.
+ */
+bool flushOutput(Connection& conn) {
+    size_t written = 0;
+    while (written < conn.output.size()) {
+        ssize_t n = send(conn.fd, conn.output.data() + written, conn.output.size() - written, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            conn.output.clear();
+            return false;
+        }
+        written += n;
+    }
+    conn.output.erase(0, written);
+    return true;
+}
+
+/**
+ * Process every complete command at the front of a connection's input:
+ * commands end with CRLF (a bare LF is accepted too), a read may hold several
+ * of them, and a command may be split across reads. The unfinished tail stays
+ * in input. A client that opened with the binary hello sends frames instead,
+ * answered by frames in one response buffer.
+ * @param input Bytes received and not yet processed.
+ * @param responses Receives one CRLF-terminated response per command.
+ * @param protocol The connection's protocol, decided on its first byte.
+ * @return False if the client sent a line too long to be a command (an
+ *         error response is appended) and should be dropped.
+ */
+bool processInput(std::string& input, std::vector<std::string>& responses, unsigned& protocol) {
+    if (protocol == PROTOCOL_UNKNOWN) {
+        std::string hello;
+        negotiateProtocol(input, hello, protocol);
+        if (!hello.empty()) {
+            responses.push_back(hello);
+        }
+    }
+    if (protocol == PROTOCOL_BINARY) {
+        std::string frames;
+        processFrames(input, frames, processFrame);
+        if (!frames.empty()) {
+            responses.push_back(frames);
+        }
+        return true;
+    }
+
+    size_t start = 0;  // Start of the next unprocessed command
+    size_t newline;
+    while ((newline = input.find('\n', start)) != std::string::npos) {
+        size_t end = newline;
+        if (end > start && input[end - 1] == '\r') {
+            end--;
+        }
+        std::string_view command(input.data() + start, end - start);
+        start = newline + 1;
+        if (command.empty()) {
+            continue;
+        }
+
+        LOG_INFO("Received command: " << command);
+        responses.push_back(processCommand(command) + "\r\n");
+    }
+    input.erase(0, start);
+
+    // A line this long without a terminator is not a command
+    if (input.size() > MAX_COMMAND_LENGTH) {
+        responses.push_back("invalid command\r\n");
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Handle one read from a client: process the complete commands received so
+ * far, queue the responses of the whole batch and write what the socket
+ * takes. A client whose queued output has passed OUTPUT_HIGH_WATER is not
+ * read until it has consumed some, so a slow reader cannot make the server
+ * buffer without bound or hold up the other clients.
+ * @param conn The client connection.
+ * @return 1 if data was handled, 0 if nothing is available now
+ *         (non-blocking socket) or the client is paused, -1 if the client
+ *         hung up, failed or should be dropped once its output is written.
+ */
+int handleClientData(Connection& conn) {
+    if (conn.output.size() >= OUTPUT_HIGH_WATER) {
+        return 0;
+    }
+
+    char buffer[16384];
+    ssize_t valread = read(conn.fd, buffer, sizeof(buffer));
+    if (valread < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+        return 0;
+    }
+    if (valread <= 0) {
+        return -1;
+    }
+    conn.input.append(buffer, valread);
 
-    std::cout << "Server is listening on port " << PORT << std::endl;
+    std::vector<std::string> responses;
+    bool keep = processInput(conn.input, responses, conn.protocol);
+    for (const std::string& response : responses) {
+        conn.output += response;
+    }
+    if (!flushOutput(conn) || !keep) {
+        return -1;
+    }
+    return 1;
+}
 
-    fd_set read_fds;  // File descriptor set for select()
+/**
+ * Input handler for the io_uring engine, which queues the responses itself.
+ */
+bool handleUringInput(std::string& input, std::string& output, unsigned& protocol) {
+    std::vector<std::string> responses;
+    bool keep = processInput(input, responses, protocol);
+    for (const std::string& response : responses) {
+        output += response;
+    }
+    return keep;
+}
+
+/**
+ * Serve clients with select(): simple, but every call rebuilds the fd_set and
+ * walks all clients, and descriptors must stay below FD_SETSIZE.
+ */
+void runSelectLoop(int server_fd) {
+    fd_set read_fds;  // Sockets to read from
+    fd_set write_fds;  // Sockets with output waiting
     int max_fd = server_fd;  // Maximum file descriptor
-    std::vector<int> client_sockets;  // List of client sockets
+    std::vector<Connection> clients;  // Connected clients
 
     while (true) {
-        FD_ZERO(&read_fds);  // Clear file descriptor set
+        FD_ZERO(&read_fds);  // Clear file descriptor sets
+        FD_ZERO(&write_fds);
         FD_SET(server_fd, &read_fds);  // Add server socket to the set
 
-        // Add all client sockets to the set
-        for (int client : client_sockets) {
-            FD_SET(client, &read_fds);
-            if (client > max_fd) {
-                max_fd = client;
+        // Read from clients that are not paused, write to those with output
+        for (const Connection& client : clients) {
+            if (!client.closing && client.output.size() < OUTPUT_HIGH_WATER) {
+                FD_SET(client.fd, &read_fds);
+            }
+            if (!client.output.empty()) {
+                FD_SET(client.fd, &write_fds);
+            }
+            if (client.fd > max_fd) {
+                max_fd = client.fd;
             }
         }
 
         // Wait for activity on sockets
-        int activity = select(max_fd + 1, &read_fds, nullptr, nullptr, nullptr);
+        int activity = select(max_fd + 1, &read_fds, &write_fds, nullptr, nullptr);
         if (activity < 0) {
+            if (errno == EINTR) continue;
             perror("select error");
             break;
         }
 
         // Check if there's an incoming connection request
         if (FD_ISSET(server_fd, &read_fds)) {
-            int new_socket = accept(server_fd, (struct sockaddr*)&address, (socklen_t*)&addrlen);
+            int new_socket = accept4(server_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
             if (new_socket < 0) {
                 perror("accept");
+            }
+            else if (new_socket >= FD_SETSIZE) {
+                LOG_WARN("Too many connections for select, use -e epoll");
+                close(new_socket);
+            }
+            else {
+                LOG_INFO("New connection accepted");
+                clients.push_back({new_socket, "", PROTOCOL_UNKNOWN});  // Add new client to the list
+            }
+        }
+
+        // Write queued output, then read from clients with incoming data
+        for (auto it = clients.begin(); it != clients.end();) {
+            bool failed = FD_ISSET(it->fd, &write_fds) && !flushOutput(*it);
+            if (!failed && FD_ISSET(it->fd, &read_fds) && handleClientData(*it) < 0) {
+                it->closing = true;
+            }
+            if (failed || (it->closing && it->output.empty())) {
+                // Client disconnected
+                LOG_INFO("Client disconnected");
+                close(it->fd);
+                it = clients.erase(it);  // Remove client from the list
                 continue;
             }
-            std::cout << "New connection accepted" << std::endl;
-            client_sockets.push_back(new_socket);  // Add new client to the list
+            ++it;
         }
+    }
+}
 
-        // Check for incoming data from clients
-        for (auto it = client_sockets.begin(); it != client_sockets.end();) {
-            int client_socket = *it;
-            if (FD_ISSET(client_socket, &read_fds)) {
-                char buffer[1024] = {0};
-                int valread = read(client_socket, buffer, sizeof(buffer));
-                if (valread <= 0) {
-                    // Client disconnected
-                    std::cout << "Client disconnected" << std::endl;
-                    close(client_socket);
-                    it = client_sockets.erase(it);  // Remove client from the list
-                    continue;
-                }
+/**
+ * Serve clients with edge-triggered epoll: the kernel reports only the
+ * sockets that became ready, so the cost per event does not grow with the
+ * number of connections. Every socket is non-blocking and is drained until
+ * EAGAIN, since an edge is reported only once.
+ */
+void runEpollLoop(int server_fd) {
+    const int MAX_EVENTS = 256;  // Events handled per epoll_wait call
+
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        perror("epoll_create1");
+        exit(EXIT_FAILURE);
+    }
+    setNonBlocking(server_fd);
 
-                std::string command(buffer);
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = nullptr;  // Clients carry their Connection, the listener nothing
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, server_fd, &ev) < 0) {
+        perror("epoll_ctl");
+        exit(EXIT_FAILURE);
+    }
 
-                // Remove possible newline characters from the command
-                if (command.size() >= 2 && command.substr(command.size() - 2) == "\r\n") {
-                    command = command.substr(0, command.size() - 2);
+    struct epoll_event events[MAX_EVENTS];
+    while (true) {
+        int ready = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            break;
+        }
+
+        for (int i = 0; i < ready; i++) {
+            Connection* conn = static_cast<Connection*>(events[i].data.ptr);
+
+            // Accept every pending connection
+            if (conn == nullptr) {
+                while (true) {
+                    int new_socket = accept4(server_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                    if (new_socket < 0) {
+                        if (errno == EINTR) continue;
+                        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                            perror("accept");
+                        }
+                        break;
+                    }
+                    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+                    ev.data.ptr = new Connection{new_socket, "", PROTOCOL_UNKNOWN};
+                    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, new_socket, &ev) < 0) {
+                        perror("epoll_ctl");
+                        delete static_cast<Connection*>(ev.data.ptr);
+                        close(new_socket);
+                        continue;
+                    }
+                    LOG_INFO("New connection accepted");
                 }
-                std::cout << "Received command: " << command << std::endl;
+                continue;
+            }
 
-                // Process the command and send the response back to the client
-                std::string response = processCommand(command);
-                send(client_socket, response.c_str(), response.size(), 0);
+            // Write what is queued, then read until the socket is drained, the
+            // client is gone or its output passes the high-water mark. The
+            // socket becoming writable again resumes a paused client; commands
+            // sent just before a hang-up are still answered
+            bool failed = (events[i].events & EPOLLERR) || !flushOutput(*conn);
+            if (!failed && !conn->closing) {
+                int result;
+                while ((result = handleClientData(*conn)) > 0) {
+                    // Keep reading until EAGAIN
+                }
+                conn->closing = result < 0;
+            }
+            if (failed || (conn->closing && conn->output.empty())) {
+                LOG_INFO("Client disconnected");
+                close(conn->fd);  // Closing also removes it from the epoll set
+                delete conn;
             }
-            ++it;
         }
     }
 
+    close(epoll_fd);
+}
+
+/**
+ * Run one shard: pin the thread to a core, open its own listening socket on
+ * the shared port and serve its connections with the chosen event loop.
+ */
+void runShard(unsigned shard, int port, const std::string& engine) {
+    current_shard = shard;
+
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if (shard_count > 1 && cores > 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(shard % cores, &cpus);
+        pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    }
+
+    int server_fd = createServerSocket(port);
+    if (engine == "uring") {
+        runUringServer(server_fd, handleUringInput);
+        LOG_WARN("io_uring failed, falling back to epoll");
+        runEpollLoop(server_fd);
+    }
+    else if (engine == "epoll") {
+        runEpollLoop(server_fd);
+    }
+    else {
+        runSelectLoop(server_fd);
+    }
     close(server_fd);  // Close the server socket
+}
+
+int main(int argc, char* argv[]) {
+    const int PORT = 8080;  // Port to listen on
+    std::string engine = "epoll";  // Event loop: uring, epoll or select
+    long threads = 1;  // Event-loop threads (shards)
+    LogLevel level = LOG_LEVEL_INFO;
+
+    // Parse command-line options
+    int opt;
+    while ((opt = getopt(argc, argv, "e:t:q")) != -1) {
+        switch (opt) {
+            case 'e':
+                engine = optarg;
+                break;
+            case 't':
+                threads = strtol(optarg, nullptr, 10);
+                break;
+            case 'q':
+                level = LOG_LEVEL_ERROR;
+                break;
+            default:
+                std::cerr << "Usage: " << argv[0] << " [-e uring|epoll|select] [-t <threads>] [-q]" << std::endl;
+                std::cerr << "  -t  event-loop threads, each with its own SO_REUSEPORT listener"
+                          << " and pinned to a core (0 = one per core)" << std::endl;
+                std::cerr << "  -q  quiet: log errors only, without formatting the other messages" << std::endl;
+                return EXIT_FAILURE;
+        }
+    }
+    if (engine != "uring" && engine != "epoll" && engine != "select") {
+        std::cerr << "Unknown event loop " << engine << " (use uring, epoll or select)" << std::endl;
+        return EXIT_FAILURE;
+    }
+    startLogger(level);
+    if (engine == "uring" && !uringAvailable()) {
+        LOG_WARN("io_uring is not supported by this kernel, falling back to epoll");
+        engine = "epoll";
+    }
+    if (threads <= 0) {
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    shard_count = threads > 0 ? (unsigned)threads : 1;
+    shards = new ShardCounters[shard_count]();
+
+    signal(SIGPIPE, SIG_IGN);  // A vanished client must not kill the server
+    LOG_INFO("Server is listening on port " << PORT << " (" << engine << ", "
+             << shard_count << (shard_count == 1 ? " thread" : " threads") << ")");
+
+    std::vector<std::thread> workers;
+    for (unsigned i = 1; i < shard_count; i++) {
+        workers.emplace_back(runShard, i, PORT, engine);
+    }
+    runShard(0, PORT, engine);
+
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    delete[] shards;
     return 0;
 }
@@ -3,6 +3,31 @@
 #include <string>
 #include <unistd.h>
 #include <arpa/inet.h>
+#include "binaryProtocol.h"
+
+bool binary = false;  // Speak the binary protocol instead of text commands
+uint32_t request_id = 0;  // Id of the last binary request
+
+// Build "hello + frame" for a command; false if the command is invalid
+bool binaryRequest(const std::string& command, std::string& request) {
+    Frame frame;
+    if (!commandToFrame(command, ++request_id, frame)) {
+        std::cout << "Invalid command" << std::endl;
+        return false;
+    }
+    request.assign(1, (char)PROTOCOL_HELLO);
+    appendFrame(request, frame);
+    return true;
+}
+
+// Print a binary reply (hello byte and one response frame)
+void printBinaryReply(const char* reply, ssize_t size) {
+    if (size != (ssize_t)(1 + FRAME_SIZE) || (uint8_t)reply[0] != PROTOCOL_HELLO) {
+        std::cout << "Server does not support the binary protocol" << std::endl;
+        return;
+    }
+    std::cout << "Server response: " << describeFrame(decodeFrame(reply + 1)) << std::endl;
+}
 
 // Sends a TCP command to a server
 void sendTcpCommand(const std::string& command) {
@@ -34,6 +59,22 @@ void sendTcpCommand(const std::string& command) {
         return;
     }
 
+    // A binary request is answered with the hello byte and one frame
+    if (binary) {
+        std::string request;
+        if (binaryRequest(command, request)) {
+            send(sock, request.data(), request.size(), 0);
+            char reply[1 + FRAME_SIZE];
+            ssize_t got = 0, n;
+            while (got < (ssize_t)sizeof(reply) && (n = read(sock, reply + got, sizeof(reply) - got)) > 0) {
+                got += n;
+            }
+            printBinaryReply(reply, got);
+        }
+        close(sock);
+        return;
+    }
+
     // Send command to server
     std::string message = command + "\r\n";
     send(sock, message.c_str(), message.size(), 0);
@@ -65,6 +106,19 @@ void sendUdpCommand(const std::string& command) {
     serv_addr.sin_port = htons(PORT);
     inet_pton(AF_INET, SERVER_IP, &serv_addr.sin_addr);
 
+    // A binary datagram carries the hello byte and one frame, and so does the reply
+    if (binary) {
+        std::string request;
+        if (binaryRequest(command, request)) {
+            sendto(sock, request.data(), request.size(), 0, (const struct sockaddr*)&serv_addr, sizeof(serv_addr));
+            char reply[1024];
+            ssize_t n = recvfrom(sock, reply, sizeof(reply), 0, nullptr, nullptr);
+            printBinaryReply(reply, n);
+        }
+        close(sock);
+        return;
+    }
+
     // Send command to server
     std::string message = command + "\r\n";
     sendto(sock, message.c_str(), message.size(), 0, (const struct sockaddr*)&serv_addr, sizeof(serv_addr));
@@ -80,7 +134,17 @@ void sendUdpCommand(const std::string& command) {
 }
 
 // Main function to handle user input and send commands
-int main() {
+int main(int argc, char* argv[]) {
+    // Parse command-line options
+    int opt;
+    while ((opt = getopt(argc, argv, "b")) != -1) {
+        if (opt != 'b') {
+            std::cerr << "Usage: " << argv[0] << " [-b]" << std::endl;
+            return 1;
+        }
+        binary = true;
+    }
+
     while (true) {
         std::string protocol, command;
 
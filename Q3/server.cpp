@@ -1,25 +1,31 @@
 #include <iostream>
 #include <cstring>
 #include <string>
-#include <sstream>
 #include <thread>
 #include <unistd.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
-#include <mutex>
-#include <map>
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <csignal>
+#include <pthread.h>
+#include <sched.h>
 #include <vector>
+#include "ioUring.h"
+#include "poolServer.h"
+#include "datagramServer.h"
+#include "commandParser.h"
+#include "atomInventory.h"
+#include "binaryProtocol.h"
+#include "logger.h"
 
 // Maximum allowable atom count
 const long long MAX_ATOMS = 1000000000000000000LL;
 
-// Global atom counts
-long long carbon_atoms = 0;
-long long oxygen_atoms = 0;
-long long hydrogen_atoms = 0;
-
-// Mutex to ensure thread-safe access to atom counts
-std::mutex atom_lock;
+// Atom counts shared by every thread: per-thread caches, each behind its own
+// mutex, over a pool changed one reservation at a time (see AtomInventory)
+AtomInventory inventory(MAX_ATOMS);
 
 // Molecule structure to define required atom counts for each type
 struct Molecule {
@@ -28,203 +34,249 @@ struct Molecule {
     int oxygen;
 };
 
-// Predefined list of molecules and their atom requirements
-const std::map<std::string, Molecule> molecules = {
-    {"WATER", {0, 2, 1}},
-    {"CARBON DIOXIDE", {1, 0, 2}},
-    {"GLUCOSE", {6, 12, 6}},
-    {"ALCOHOL", {2, 6, 1}},
-    {"SOFT DRINK", {7, 14, 9}},
-    {"VODKA", {8, 20, 8}},
-    {"CHAMPAGNE", {3, 8, 4}}
+// Atoms needed for each molecule, indexed by MoleculeId; molecules this
+// stage does not make need none
+const Molecule molecules[MOLECULE_TYPES] = {
+    {2, 6, 1}, // ALCOHOL
+    {1, 0, 2}, // CARBON DIOXIDE
+    {3, 8, 4}, // CHAMPAGNE
+    {6, 12, 6}, // GLUCOSE
+    {7, 14, 9}, // SOFT DRINK
+    {8, 20, 8}, // VODKA
+    {0, 2, 1} // WATER
 };
 
+// Recipe of a molecule this stage makes, or nullptr
+const Molecule* findRecipe(MoleculeId id) {
+    if (id == MOLECULE_TYPES) return nullptr;
+    const Molecule& mol = molecules[id];
+    return mol.carbon + mol.hydrogen + mol.oxygen > 0 ? &mol : nullptr;
+}
+
+// How many molecules the given atoms make; atoms a recipe does not use
+// do not limit it
+long long maxMolecules(const Molecule& mol, const AtomInventory::Counts& atoms) {
+    long long count = LLONG_MAX;
+    if (mol.carbon > 0) count = std::min(count, atoms[CARBON] / mol.carbon);
+    if (mol.hydrogen > 0) count = std::min(count, atoms[HYDROGEN] / mol.hydrogen);
+    if (mol.oxygen > 0) count = std::min(count, atoms[OXYGEN] / mol.oxygen);
+    return count;
+}
+
 // Function to handle keyboard input commands
 // Commands are entered directly in the terminal and processed
-bool processKeyboardCommand(const std::string& command) {
-    std::istringstream iss(command);
-    std::string gen;
+bool processKeyboardCommand(std::string_view command) {
+    MoleculeId id;
+    long long quantity; // Parsed for compatibility; one molecule is generated
 
-    // Validate that the command starts with "GEN"
-    if (!(iss >> gen) || gen != "GEN") {
-        std::cout << "ERROR: Invalid command!" << std::endl;
+    // Validate that the command starts with "GEN" and names a known drink
+    if (!parseMoleculeCommand(command, "GEN", id, quantity)) {
+        LOG_ERROR("ERROR: Invalid command!");
         return false;
     }
-
-    // Parse molecule name and quantity
-    std::string rest;
-    std::getline(iss, rest);
-    rest.erase(0, rest.find_first_not_of(" \t")); // Trim leading spaces
-    rest.erase(rest.find_last_not_of(" \t") + 1); // Trim trailing spaces
-
-    size_t last_space = rest.find_last_of(" ");
-    std::string drink;
-    long long quantity = 1; // Default quantity is 1
-
-    if (last_space != std::string::npos && std::isdigit(rest[last_space + 1])) {
-        drink = rest.substr(0, last_space); // Extract molecule name
-        quantity = std::stoll(rest.substr(last_space + 1)); // Extract quantity
-    } else {
-        drink = rest;
-    }
-
-    // Verify that the molecule is valid
-    auto it = molecules.find(drink);
-    if (it == molecules.end()) {
-        std::cout << "ERROR: Invalid drink!" << std::endl;
+    const Molecule* recipe = findRecipe(id);
+    if (recipe == nullptr) {
+        LOG_ERROR("ERROR: Invalid drink!");
         return false;
     }
 
-    const Molecule& molecule = it->second;
-
-    // Lock for thread-safe operations
-    std::lock_guard<std::mutex> guard(atom_lock);
+    const Molecule& molecule = *recipe;
+    std::string_view drink = MOLECULE_NAMES[id];
 
-    long long max_molecules = std::min(
-        carbon_atoms / molecule.carbon,
-        std::min(hydrogen_atoms / molecule.hydrogen,
-                 oxygen_atoms / molecule.oxygen)
-    );
+    AtomInventory::Counts atoms = inventory.snapshot(); // Every cache included
+    long long max_molecules = maxMolecules(molecule, atoms);
 
-    // Check if sufficient atoms are available
-    if (carbon_atoms <= 0 || hydrogen_atoms <= 0 || oxygen_atoms <= 0 || max_molecules <= 0) {
-        std::cout << "ERROR: Not enough atoms to generate the molecules!" << std::endl;
+    // Check if sufficient atoms are available, then take those of one molecule
+    if (atoms[CARBON] <= 0 || atoms[HYDROGEN] <= 0 || atoms[OXYGEN] <= 0 ||
+        max_molecules <= 0 || !inventory.take({molecule.carbon, molecule.oxygen, molecule.hydrogen})) {
+        LOG_ERROR("ERROR: Not enough atoms to generate the molecules!");
         return false;
     }
 
-    // Deduct atoms for one molecule
-    carbon_atoms -= molecule.carbon;
-    hydrogen_atoms -= molecule.hydrogen;
-    oxygen_atoms -= molecule.oxygen;
-
     // Log success
-    std::cout << "Generated " << drink << std::endl;
-    std::cout << "Remaining atoms: Carbon = " << carbon_atoms
-              << ", Hydrogen = " << hydrogen_atoms
-              << ", Oxygen = " << oxygen_atoms << std::endl;
-    std::cout << "You can generate " << max_molecules - 1 << " more " << drink << std::endl;
+    LOG_INFO("Generated " << drink);
+    LOG_INFO("Remaining atoms: Carbon = " << inventory.count(CARBON)
+             << ", Hydrogen = " << inventory.count(HYDROGEN)
+             << ", Oxygen = " << inventory.count(OXYGEN));
+    LOG_INFO("You can generate " << max_molecules - 1 << " more " << drink);
 
     // Print how many of each molecule can still be generated
-    for (const auto& mol : molecules) {
-        const Molecule& m = mol.second;
-        long long max_possible = std::min(
-            carbon_atoms / m.carbon,
-            std::min(hydrogen_atoms / m.hydrogen,
-                     oxygen_atoms / m.oxygen)
-        );
-        std::cout << "You can generate " << max_possible << " more " << mol.first << std::endl;
+    atoms = inventory.snapshot();
+    for (int i = 0; i < MOLECULE_TYPES; i++) {
+        long long max_possible = maxMolecules(molecules[i], atoms);
+        LOG_INFO("You can generate " << max_possible << " more " << MOLECULE_NAMES[i]);
     }
 
     return true;
 }
 
-// Function to process atom addition commands
-std::string processAtomCommand(const std::string& command) {
-    std::string atom;
+// Add atoms unless the total would pass MAX_ATOMS
+FrameStatus addAtoms(Atom atom, long long count) {
+    static const char* const NAMES[ATOM_TYPES] = {"Carbon", "Oxygen", "Hydrogen"};
+    if (!inventory.add(atom, count)) return STATUS_LIMIT;
+    LOG_INFO("Added " << count << " " << NAMES[atom]);
+
+    // Log remaining atom counts
+    LOG_INFO("Remaining atoms: Carbon = " << inventory.count(CARBON)
+             << ", Hydrogen = " << inventory.count(HYDROGEN)
+             << ", Oxygen = " << inventory.count(OXYGEN));
+
+    return STATUS_OK;
+}
+
+// Processes atom addition commands like "ADD CARBON 10"
+std::string processAtomCommand(std::string_view command) {
+    static const char* const LIMIT_ERRORS[ATOM_TYPES] = {
+        "error: carbon atoms limit exceeded",
+        "error: oxygen atoms limit exceeded",
+        "error: hydrogen atoms limit exceeded"
+    };
+    Atom atom;
     long long count;
-    std::istringstream iss(command);
-    std::string add;
 
-    // Validate that the command starts with "ADD"
-    if (!(iss >> add >> atom >> count) || add != "ADD") {
+    // Validate the command, the atom type and the count
+    if (!parseAddCommand(command, atom, count)) {
         return "invalid command";
     }
-
-    // Validate atom type
-    if (atom != "CARBON" && atom != "OXYGEN" && atom != "HYDROGEN") {
-        return "invalid command";
+    if (addAtoms(atom, count) == STATUS_LIMIT) {
+        return LIMIT_ERRORS[atom];
     }
+    return "OK\r\n";
+}
 
-    // Lock for thread-safe addition
-    std::lock_guard<std::mutex> guard(atom_lock);
-
-    // Add atoms to the appropriate counter
-    if (atom == "CARBON") {
-        if (carbon_atoms + count > MAX_ATOMS) return "error: carbon atoms limit exceeded";
-        carbon_atoms += count;
-        std::cout << "Added " << count << " Carbon" << std::endl;
-    } else if (atom == "OXYGEN") {
-        if (oxygen_atoms + count > MAX_ATOMS) return "error: oxygen atoms limit exceeded";
-        oxygen_atoms += count;
-        std::cout << "Added " << count << " Oxygen" << std::endl;
-    } else if (atom == "HYDROGEN") {
-        if (hydrogen_atoms + count > MAX_ATOMS) return "error: hydrogen atoms limit exceeded";
-        hydrogen_atoms += count;
-        std::cout << "Added " << count << " Hydrogen" << std::endl;
+// Executes a binary ADD frame received over TCP
+Frame processAtomFrame(const Frame& request) {
+    Frame response = request;
+    if (request.opcode != OPCODE_ADD) {
+        response.status = request.opcode == OPCODE_DELIVER || request.opcode == OPCODE_GEN ? STATUS_UNSUPPORTED
+                                                                                          : STATUS_INVALID;
+    } else if (request.id >= ATOM_TYPES || request.count > (uint64_t)MAX_ATOMS) {
+        response.status = STATUS_INVALID;
+    } else {
+        response.status = addAtoms((Atom)request.id, (long long)request.count);
     }
-
-    // Log remaining atom counts
-    std::cout << "Remaining atoms: Carbon = " << carbon_atoms
-              << ", Hydrogen = " << hydrogen_atoms
-              << ", Oxygen = " << oxygen_atoms << std::endl;
-
-    return "OK\r\n";
+    return response;
 }
 
-// Function to process molecule delivery commands
-std::string processMoleculeCommand(const std::string& command) {
-    std::istringstream iss(command);
-    std::string deliver;
+// Deliver molecules if there are enough atoms for all of them
+FrameStatus deliverMolecules(MoleculeId id, long long count) {
+    const Molecule* recipe = findRecipe(id);
+    if (recipe == nullptr) return STATUS_INVALID;
 
-    // Validate that the command starts with "DELIVER"
-    if (!(iss >> deliver) || deliver != "DELIVER") {
-        return "ERROR\r\n";
-    }
+    const Molecule& mol = *recipe;
+    std::string_view molecule = MOLECULE_NAMES[id];
 
-    // Parse molecule name and quantity
-    std::string rest;
-    std::getline(iss, rest);
-    rest.erase(0, rest.find_first_not_of(" \t")); // Trim leading spaces
-    rest.erase(rest.find_last_not_of(" \t") + 1); // Trim trailing spaces
+    // No more molecules than MAX_ATOMS of their most used atom make, which
+    // also keeps the atom counts below from overflowing
+    if (count < 0 || count > MAX_ATOMS / std::max({mol.carbon, mol.hydrogen, mol.oxygen})) return STATUS_INVALID;
 
-    size_t last_space = rest.find_last_of(" ");
-    std::string molecule;
-    long long count = 1;
+    // Every atom of the delivery, or nothing
+    if (inventory.take({mol.carbon * count, mol.oxygen * count, mol.hydrogen * count})) {
+        LOG_INFO("Delivered " << count << " " << molecule);
 
-    if (last_space != std::string::npos && std::isdigit(rest[last_space + 1])) {
-        molecule = rest.substr(0, last_space);
-        count = std::stoll(rest.substr(last_space + 1));
-    } else {
-        molecule = rest;
+        // Log remaining atom counts
+        LOG_INFO("Remaining atoms: Carbon = " << inventory.count(CARBON)
+                 << ", Hydrogen = " << inventory.count(HYDROGEN)
+                 << ", Oxygen = " << inventory.count(OXYGEN));
+
+        return STATUS_OK;
     }
 
-    auto it = molecules.find(molecule);
-    if (it == molecules.end()) return "ERROR\r\n";
+    // Log failure
+    LOG_WARN("Failed to deliver " << count << " " << molecule);
+    return STATUS_SHORTAGE;
+}
 
-    const Molecule& mol = it->second;
+// Processes molecule delivery commands like "DELIVER WATER 10"
+std::string processMoleculeCommand(std::string_view command) {
+    MoleculeId id;
+    long long count;
 
-    // Lock for thread-safe operations
-    std::lock_guard<std::mutex> guard(atom_lock);
-    long long required_c = mol.carbon * count;
-    long long required_h = mol.hydrogen * count;
-    long long required_o = mol.oxygen * count;
+    // Validate the command, the molecule and the optional quantity
+    if (!parseMoleculeCommand(command, "DELIVER", id, count)) {
+        return "ERROR\r\n";
+    }
+    return deliverMolecules(id, count) == STATUS_OK ? "OK\r\n" : "ERROR\r\n";
+}
 
-    if (carbon_atoms >= required_c && hydrogen_atoms >= required_h && oxygen_atoms >= required_o) {
-        carbon_atoms -= required_c;
-        hydrogen_atoms -= required_h;
-        oxygen_atoms -= required_o;
-        std::cout << "Delivered " << count << " " << molecule << std::endl;
+// Executes a binary DELIVER frame received over UDP
+Frame processMoleculeFrame(const Frame& request) {
+    Frame response = request;
+    if (request.opcode != OPCODE_DELIVER) {
+        response.status = request.opcode == OPCODE_ADD || request.opcode == OPCODE_GEN ? STATUS_UNSUPPORTED
+                                                                                      : STATUS_INVALID;
+    } else if (request.id >= MOLECULE_TYPES || request.count > (uint64_t)MAX_ATOMS) {
+        response.status = STATUS_INVALID;
+    } else {
+        response.status = deliverMolecules((MoleculeId)request.id, (long long)request.count);
+    }
+    return response;
+}
 
-        // Log remaining atom counts
-        std::cout << "Remaining atoms: Carbon = " << carbon_atoms
-                  << ", Hydrogen = " << hydrogen_atoms
-                  << ", Oxygen = " << oxygen_atoms << std::endl;
+// Longest command line accepted on a TCP connection
+const size_t MAX_COMMAND_LENGTH = 4096;
+
+// Process every complete command at the front of input: commands end with
+// CRLF (a bare LF is accepted too), one read may carry many of them and a
+// command may be split across reads, so the unfinished tail stays in input.
+// A client that opened with the binary hello sends frames instead. Returns
+// false if the client sent a line too long to be a command
+bool processTcpInput(std::string& input, std::vector<std::string>& responses, unsigned& protocol) {
+    if (protocol == PROTOCOL_UNKNOWN) {
+        std::string hello;
+        negotiateProtocol(input, hello, protocol);
+        if (!hello.empty()) responses.push_back(hello);
+    }
+    if (protocol == PROTOCOL_BINARY) {
+        std::string frames;
+        processFrames(input, frames, processAtomFrame);
+        if (!frames.empty()) responses.push_back(frames);
+        return true;
+    }
 
-        return "OK\r\n";
+    size_t start = 0; // Start of the next unprocessed command
+    size_t newline;
+    while ((newline = input.find('\n', start)) != std::string::npos) {
+        size_t end = newline;
+        if (end > start && input[end - 1] == '\r') end--;
+        std::string_view command(input.data() + start, end - start);
+        start = newline + 1;
+        if (command.empty()) continue;
+        LOG_INFO("TCP command received: " << command);
+
+        std::string response = processAtomCommand(command);
+        LOG_INFO("Response: " << response);
+        if (response.size() < 2 || response.compare(response.size() - 2, 2, "\r\n") != 0) {
+            response += "\r\n"; // Every response is a line of its own
+        }
+        responses.push_back(response);
     }
+    input.erase(0, start);
 
-    // Log failure
-    std::cout << "Failed to deliver " << count << " " << molecule << std::endl;
-    return "ERROR\r\n";
+    // A line this long without a terminator is not a command
+    if (input.size() > MAX_COMMAND_LENGTH) {
+        responses.push_back("invalid command\r\n");
+        return false;
+    }
+    return true;
+}
+
+// Input handler for both TCP engines, which queue the responses themselves
+bool handleStreamInput(std::string& input, std::string& output, unsigned& protocol) {
+    std::vector<std::string> responses;
+    bool keep = processTcpInput(input, responses, protocol);
+    for (const std::string& response : responses) {
+        output += response;
+    }
+    return keep;
 }
 
 // TCP server to handle client connections
-void tcpServer(int port) {
+void tcpServer(int port, const std::string& engine, unsigned max_connections) {
     // Server initialization and setup
-    int server_fd, new_socket;
+    int server_fd;
     struct sockaddr_in address;
     int opt = 1;
-    int addrlen = sizeof(address);
 
     if ((server_fd = socket(AF_INET, SOCK_STREAM, 0)) == 0) {
         perror("socket failed");
@@ -245,56 +297,65 @@ void tcpServer(int port) {
         exit(EXIT_FAILURE);
     }
 
-    if (listen(server_fd, 3) < 0) {
+    if (listen(server_fd, SOMAXCONN) < 0) {
         perror("listen");
         exit(EXIT_FAILURE);
     }
 
-    std::cout << "TCP server listening on port " << port << std::endl;
+    LOG_INFO("TCP server listening on port " << port);
 
-    // Accept incoming client connections
-    while (true) {
-        if ((new_socket = accept(server_fd, (struct sockaddr*)&address, (socklen_t*)&addrlen)) < 0) {
-            perror("accept");
-            continue;
-        }
+    // One io_uring loop serves every connection on this thread
+    if (engine == "uring") {
+        runUringServer(server_fd, handleStreamInput, max_connections);
+        LOG_WARN("io_uring failed, falling back to the worker pool");
+    }
+
+    // An epoll loop hands ready connections to one worker thread per core
+    WorkerPool pool;
+    runPoolServer(server_fd, pool, handleStreamInput, max_connections, [](bool opened) {
+        if (opened) LOG_INFO("New client connected via TCP");
+    });
+}
+
+// Handles one UDP datagram: binary DELIVER frames or a text DELIVER command
+void handleDatagram(std::string_view datagram, std::string& reply) {
+    if (isBinaryDatagram(datagram.data(), datagram.size())) {
+        reply = processDatagram(datagram.data(), datagram.size(), processMoleculeFrame);
+    } else {
+        std::string_view command = datagram.substr(0, datagram.find_last_not_of("\r\n") + 1); // Remove trailing CRLF
+        LOG_INFO("UDP command received: " << command);
 
-        std::cout << "New client connected via TCP" << std::endl;
-
-        // Handle client in a separate thread
-        std::thread([new_socket]() {
-            char buffer[1024];
-            while (true) {
-                memset(buffer, 0, sizeof(buffer));
-                int valread = read(new_socket, buffer, sizeof(buffer));
-                if (valread <= 0) break;
-
-                std::string command(buffer);
-                command.erase(command.find_last_not_of("\r\n") + 1);
-                std::cout << "TCP command received: " << command << std::endl;
-
-                std::string response = processAtomCommand(command);
-                std::cout << "Response: " << response << std::endl;
-                send(new_socket, response.c_str(), response.size(), 0);
-            }
-            close(new_socket);
-        }).detach();
+        reply = processMoleculeCommand(command);
+        LOG_INFO("Response: " << reply); // Log the response
     }
 }
 
-// UDP server to handle client requests
-void udpServer(int port) {
+// One UDP worker: its own SO_REUSEPORT socket on the shared port, so the
+// kernel spreads the clients over the workers, optionally pinned to a core
+void udpServer(int port, unsigned worker, bool pin) {
     int sockfd;
-    char buffer[1024];
-    struct sockaddr_in servaddr, cliaddr;
+    struct sockaddr_in servaddr;
+    int opt = 1;
+
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if (pin && cores > 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(worker % cores, &cpus);
+        pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    }
 
     if ((sockfd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
         perror("socket creation failed");
         exit(EXIT_FAILURE);
     }
 
+    if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt))) {
+        perror("setsockopt");
+        exit(EXIT_FAILURE);
+    }
+
     memset(&servaddr, 0, sizeof(servaddr));
-    memset(&cliaddr, 0, sizeof(cliaddr));
 
     servaddr.sin_family = AF_INET;
     servaddr.sin_addr.s_addr = INADDR_ANY;
@@ -305,30 +366,63 @@ void udpServer(int port) {
         exit(EXIT_FAILURE);
     }
 
-    std::cout << "UDP server listening on port " << port << std::endl;
+    if (worker == 0) LOG_INFO("UDP server listening on port " << port);
 
-    // Listen for client requests
-    while (true) {
-        socklen_t len = sizeof(cliaddr);
-        memset(buffer, 0, sizeof(buffer));
-        int n = recvfrom(sockfd, buffer, sizeof(buffer), 0, (struct sockaddr*)&cliaddr, &len);
-        if (n > 0) {
-            std::string command(buffer);
-            command.erase(command.find_last_not_of("\r\n") + 1); // Remove trailing CRLF
-            std::cout << "UDP command received: " << command << std::endl;
-
-            std::string response = processMoleculeCommand(command);
-            std::cout << "Response: " << response << std::endl; // Log the response
-            sendto(sockfd, response.c_str(), response.size(), 0, (const struct sockaddr*)&cliaddr, len);
-        }
-    }
+    // Serve the requests in batches of everything that has arrived
+    runDatagramServer(sockfd, handleDatagram);
 }
 
 // Main function
-int main() {
+int main(int argc, char* argv[]) {
+    std::string engine = "threads"; // TCP engine: io_uring loop or the worker pool
+    LogLevel level = LOG_LEVEL_INFO; // -q logs errors only
+    unsigned max_connections = 1024; // TCP clients served at once
+    long udp_workers = 1; // UDP threads, 0 for one per core
+    bool pin_udp = false; // Pin each UDP thread to a core
+
+    // Parse command-line arguments
+    int opt;
+    while ((opt = getopt(argc, argv, "e:qn:u:a")) != -1) {
+        switch (opt) {
+            case 'e':
+                engine = optarg;
+                break;
+            case 'q':
+                level = LOG_LEVEL_ERROR;
+                break;
+            case 'n':
+                max_connections = (unsigned)std::stoul(optarg);
+                break;
+            case 'u':
+                udp_workers = strtol(optarg, nullptr, 10);
+                break;
+            case 'a':
+                pin_udp = true;
+                break;
+            default:
+                std::cerr << "Usage: " << argv[0] << " [-e uring|threads] [-q] [-n <max connections>] [-u <udp threads> [-a]]" << std::endl;
+                return 1;
+        }
+    }
+    if (engine != "uring" && engine != "threads") {
+        std::cerr << "Unknown TCP engine " << engine << " (use uring or threads)" << std::endl;
+        return 1;
+    }
+    startLogger(level);
+    if (engine == "uring" && !uringAvailable()) {
+        LOG_WARN("io_uring is not supported by this kernel, falling back to the worker pool");
+        engine = "threads";
+    }
+
+    signal(SIGPIPE, SIG_IGN); // A vanished client must not kill the server
+
     // Start TCP and UDP servers in separate threads
-    std::thread udp_thread(udpServer, 8081);
-    std::thread tcp_thread(tcpServer, 8080);
+    if (udp_workers <= 0) udp_workers = sysconf(_SC_NPROCESSORS_ONLN);
+    std::vector<std::thread> udp_threads;
+    for (long i = 0; i < std::max(udp_workers, 1L); i++) {
+        udp_threads.emplace_back(udpServer, 8081, (unsigned)i, pin_udp);
+    }
+    std::thread tcp_thread(tcpServer, 8080, engine, max_connections);
 
     // Process keyboard commands from the terminal
     while (true) {
@@ -337,7 +431,9 @@ int main() {
         processKeyboardCommand(command);
     }
 
-    udp_thread.join();
+    for (std::thread& udp_thread : udp_threads) {
+        udp_thread.join();
+    }
     tcp_thread.join();
     return 0;
 }
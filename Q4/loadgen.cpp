@@ -0,0 +1,548 @@
+// Load generator for the Q4 server: many connections send ADD over TCP and
+// DELIVER over UDP in a configurable mix, either as fast as the server
+// answers (closed loop) or at a fixed total rate (open loop), with several
+// requests in flight per connection.
+//
+// In open loop every request has an intended send time on a fixed schedule,
+// and its latency is measured from that time rather than from when it was
+// actually written. A request that has to wait because the server fell
+// behind (its connection already has depth requests outstanding) therefore
+// counts the wait too, which avoids coordinated omission.
+//
+// UDP replies can be lost or overtaken, so they are matched to their
+// requests by the echoed request id in binary mode. Text replies carry no
+// id: each connection then keeps one DELIVER in flight at most, and moves to
+// a fresh UDP socket when one is lost, so that a late reply cannot be taken
+// for the answer to a later request.
+//
+// Usage: loadgen [-c connections] [-t threads] [-r rate] [-p depth]
+//                [-m deliver percent] [-d seconds] [-b] [-H host] [-T tcp port] [-U udp port]
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <cstdlib>
+#include <unistd.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/prctl.h>
+#include "binaryProtocol.h"
+
+const uint64_t NS_PER_SECOND = 1000000000ULL;
+const uint64_t LOST_AFTER = NS_PER_SECOND;  // A DELIVER unanswered this long was lost
+const uint64_t DRAIN_TIME = 2 * NS_PER_SECOND;  // Wait for outstanding responses at the end
+
+enum RequestType { REQUEST_ADD, REQUEST_DELIVER, REQUEST_TYPES };
+
+const char* const REQUEST_NAMES[REQUEST_TYPES] = {"ADD", "DELIVER"};
+
+struct Options {
+    std::string host = "127.0.0.1";
+    int tcp_port = 8080;
+    int udp_port = 8081;
+    int connections = 8;
+    int threads = 1;
+    double rate = 0;           // Requests per second over all connections; 0 = closed loop
+    int depth = 1;             // Requests a connection may have outstanding
+    int deliver_percent = 0;   // Share of requests that are DELIVER over UDP
+    double duration = 10;      // Seconds of sending
+    bool binary = false;       // Binary frames instead of text commands
+};
+
+// What one worker thread measured
+struct Results {
+    std::vector<uint64_t> latencies[REQUEST_TYPES];  // ns from intended send to response
+    uint64_t sent = 0;
+    uint64_t errors = 0;   // Answered with anything but OK
+    uint64_t lost = 0;     // Never answered
+    uint64_t unsent = 0;   // Scheduled before the end but never sent (open loop)
+};
+
+// One TCP connection and one UDP socket to the server
+struct Connection {
+    int tcp_fd = -1;
+    int udp_fd = -1;
+    std::string output;             // TCP bytes not written yet
+    std::string input;              // Start of a TCP response not complete yet
+    bool want_write = false;        // Waiting for the TCP socket to become writable
+    bool hello_pending = false;     // Binary: the server has not acknowledged the hello yet
+    std::deque<uint64_t> tcp_waiting;  // Intended send times of the outstanding ADDs, in order
+    std::deque<std::pair<uint32_t, uint64_t>> udp_waiting;  // Request ids and intended send times of the outstanding DELIVERs
+    uint64_t next_due = 0;          // Intended send time of the next request (open loop)
+    unsigned next_atom = 0;         // Atoms are added in turn
+    int next_type = -1;             // RequestType of the next request once drawn
+    uint32_t request_id = 0;
+
+    size_t outstanding() const {
+        return tcp_waiting.size() + udp_waiting.size();
+    }
+};
+
+uint64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool setNonBlocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+// Connect a socket of the given type to the server; -1 on failure
+int connectTo(const Options& options, int type, int port) {
+    int fd = socket(AF_INET, type, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+
+    struct sockaddr_in serv_addr;
+    memset(&serv_addr, 0, sizeof(serv_addr));
+    serv_addr.sin_family = AF_INET;
+    serv_addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, options.host.c_str(), &serv_addr.sin_addr) <= 0) {
+        std::cerr << "Invalid address " << options.host << std::endl;
+        close(fd);
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr*)&serv_addr, sizeof(serv_addr)) < 0) {
+        perror(type == SOCK_STREAM ? "TCP connect" : "UDP connect");
+        close(fd);
+        return -1;
+    }
+
+    int one = 1;
+    if (type == SOCK_STREAM) setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    setNonBlocking(fd);
+    return fd;
+}
+
+// Text replies: Q2-Q4 answer OK, Q1 answers "added <n> <atom> atoms"
+bool isSuccess(std::string_view reply) {
+    return reply.substr(0, 2) == "OK" || reply.substr(0, 6) == "added ";
+}
+
+// epoll_wait with a timeout in nanoseconds, so that an open-loop schedule
+// does not have to be rounded to milliseconds (or polled)
+int waitForEvents(int epoll_fd, std::vector<struct epoll_event>& events, uint64_t timeout) {
+    struct timespec ts = {(time_t)(timeout / NS_PER_SECOND), (long)(timeout % NS_PER_SECOND)};
+    int ready = epoll_pwait2(epoll_fd, events.data(), (int)events.size(), &ts, nullptr);
+    if (ready < 0 && errno == ENOSYS) {
+        // Kernels before 5.11: round up to whole milliseconds
+        ready = epoll_wait(epoll_fd, events.data(), (int)events.size(), (int)((timeout + 999999) / 1000000));
+    }
+    return ready;
+}
+
+// Drives a share of the connections from one thread with epoll
+class Worker {
+public:
+    Worker(const Options& options, int first, int count, unsigned seed)
+        : options_(options), first_(first), connections_(count), random_(seed) {}
+
+    // Connect every connection; false if one fails
+    bool connectAll() {
+        for (Connection& conn : connections_) {
+            conn.tcp_fd = connectTo(options_, SOCK_STREAM, options_.tcp_port);
+            conn.udp_fd = connectTo(options_, SOCK_DGRAM, options_.udp_port);
+            if (conn.tcp_fd < 0 || conn.udp_fd < 0) return false;
+            if (options_.binary) {
+                conn.output.push_back((char)PROTOCOL_HELLO);
+                conn.hello_pending = true;
+            }
+        }
+        return true;
+    }
+
+    // Send from start until end, then collect the last responses
+    void run(uint64_t start, uint64_t end) {
+        epoll_fd_ = epoll_create1(0);
+        for (size_t i = 0; i < connections_.size(); i++) {
+            watch(EPOLL_CTL_ADD, connections_[i].tcp_fd, i * 2, EPOLLIN);
+            watch(EPOLL_CTL_ADD, connections_[i].udp_fd, i * 2 + 1, EPOLLIN);
+        }
+
+        // Spread the connections' schedules evenly over one interval
+        uint64_t interval = options_.rate > 0 ? (uint64_t)(NS_PER_SECOND * options_.connections / options_.rate) : 0;
+        for (size_t i = 0; i < connections_.size(); i++) {
+            connections_[i].next_due = start + interval * (first_ + i) / options_.connections;
+        }
+
+        std::vector<struct epoll_event> events(connections_.size() * 2 + 1);
+        while (true) {
+            uint64_t now = nowNs();
+            bool sending = now < end;
+            size_t outstanding = 0;
+            uint64_t wake = now + NS_PER_SECOND / 10;
+            for (Connection& conn : connections_) {
+                if (sending) issueRequests(conn, now, interval);
+                flushOutput(conn);
+                expireLost(conn, now);
+                outstanding += conn.outstanding();
+                if (sending && interval > 0 && canSend(conn)) {
+                    wake = std::min(wake, conn.next_due);
+                }
+            }
+            if (!sending && (outstanding == 0 || now >= end + DRAIN_TIME)) break;
+            if (sending) wake = std::min(wake, end);
+
+            int ready = waitForEvents(epoll_fd_, events, wake > now ? wake - now : 0);
+            for (int i = 0; i < ready; i++) {
+                Connection& conn = connections_[events[i].data.u64 / 2];
+                if (events[i].data.u64 % 2 == 1) {
+                    readUdp(conn);
+                } else if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+                    readTcp(conn);
+                }
+            }
+        }
+
+        // What the server never answered or the schedule never got to send
+        for (Connection& conn : connections_) {
+            results_.lost += conn.outstanding();
+            while (interval > 0 && conn.next_due < end) {
+                results_.unsent++;
+                conn.next_due += interval;
+            }
+            close(conn.tcp_fd);
+            close(conn.udp_fd);
+        }
+        close(epoll_fd_);
+    }
+
+    Results& results() {
+        return results_;
+    }
+
+private:
+    void watch(int op, int fd, uint64_t tag, uint32_t events) {
+        struct epoll_event ev;
+        ev.events = events;
+        ev.data.u64 = tag;
+        epoll_ctl(epoll_fd_, op, fd, &ev);
+    }
+
+    // Whether the connection has room for its next request. Text DELIVER
+    // replies cannot be told apart, so only one may be outstanding
+    bool canSend(Connection& conn) {
+        if (conn.outstanding() >= (size_t)options_.depth) return false;
+        if (conn.next_type < 0) {
+            conn.next_type = (int)(random_() % 100) < options_.deliver_percent ? REQUEST_DELIVER : REQUEST_ADD;
+        }
+        return options_.binary || conn.next_type != REQUEST_DELIVER || conn.udp_waiting.empty();
+    }
+
+    // Send what is due: in closed loop as soon as a slot is free, in open
+    // loop every request whose intended time has come, each stamped with it
+    void issueRequests(Connection& conn, uint64_t now, uint64_t interval) {
+        while (canSend(conn)) {
+            uint64_t intended = now;
+            if (interval > 0) {
+                if (conn.next_due > now) break;
+                intended = conn.next_due;
+                conn.next_due += interval;
+            }
+            if (conn.next_type == REQUEST_DELIVER) {
+                sendDeliver(conn, intended);
+            } else {
+                queueAdd(conn, intended);
+            }
+            conn.next_type = -1;
+            results_.sent++;
+        }
+    }
+
+    void queueAdd(Connection& conn, uint64_t intended) {
+        Atom atom = (Atom)(conn.next_atom++ % ATOM_TYPES);
+        if (options_.binary) {
+            appendFrame(conn.output, {OPCODE_ADD, (uint8_t)atom, 0, ++conn.request_id, 1});
+        } else {
+            conn.output += "ADD ";
+            conn.output += ATOM_NAMES[atom];
+            conn.output += " 1\r\n";
+        }
+        conn.tcp_waiting.push_back(intended);
+    }
+
+    void sendDeliver(Connection& conn, uint64_t intended) {
+        std::string datagram;
+        uint32_t id = ++conn.request_id;
+        if (options_.binary) {
+            datagram.assign(1, (char)PROTOCOL_HELLO);
+            appendFrame(datagram, {OPCODE_DELIVER, WATER, 0, id, 1});
+        } else {
+            datagram = "DELIVER WATER 1\r\n";
+        }
+        // A datagram the socket cannot take now never reaches the server
+        if (send(conn.udp_fd, datagram.data(), datagram.size(), 0) < 0) {
+            results_.lost++;
+            return;
+        }
+        conn.udp_waiting.emplace_back(id, intended);
+    }
+
+    void flushOutput(Connection& conn) {
+        while (!conn.output.empty()) {
+            ssize_t n = send(conn.tcp_fd, conn.output.data(), conn.output.size(), MSG_NOSIGNAL);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                if (errno != EAGAIN && errno != EWOULDBLOCK) conn.output.clear();
+                break;
+            }
+            conn.output.erase(0, n);
+        }
+        bool want_write = !conn.output.empty();
+        if (want_write != conn.want_write) {
+            conn.want_write = want_write;
+            watch(EPOLL_CTL_MOD, conn.tcp_fd, (&conn - connections_.data()) * 2, want_write ? EPOLLIN | EPOLLOUT : EPOLLIN);
+        }
+    }
+
+    void expireLost(Connection& conn, uint64_t now) {
+        bool expired = false;
+        while (!conn.udp_waiting.empty() && conn.udp_waiting.front().second + LOST_AFTER < now) {
+            conn.udp_waiting.pop_front();
+            results_.lost++;
+            expired = true;
+        }
+
+        // A late text reply would be taken for the next request's: drop the
+        // socket it would arrive on
+        if (expired && !options_.binary) {
+            size_t index = &conn - connections_.data();
+            close(conn.udp_fd);
+            conn.udp_fd = connectTo(options_, SOCK_DGRAM, options_.udp_port);
+            if (conn.udp_fd < 0) exit(1);
+            watch(EPOLL_CTL_ADD, conn.udp_fd, index * 2 + 1, EPOLLIN);
+        }
+    }
+
+    void complete(std::deque<uint64_t>& waiting, RequestType type, bool ok) {
+        if (waiting.empty()) return;  // An answer to a request already counted as lost
+        results_.latencies[type].push_back(nowNs() - waiting.front());
+        waiting.pop_front();
+        if (!ok) results_.errors++;
+    }
+
+    // Record the answer to the outstanding DELIVER with this id; one that
+    // already counted as lost is ignored
+    void completeDeliver(Connection& conn, uint32_t id, bool ok) {
+        for (auto it = conn.udp_waiting.begin(); it != conn.udp_waiting.end(); ++it) {
+            if (it->first == id) {
+                results_.latencies[REQUEST_DELIVER].push_back(nowNs() - it->second);
+                conn.udp_waiting.erase(it);
+                if (!ok) results_.errors++;
+                return;
+            }
+        }
+    }
+
+    void readTcp(Connection& conn) {
+        char buffer[16384];
+        while (true) {
+            ssize_t n = recv(conn.tcp_fd, buffer, sizeof(buffer), 0);
+            if (n < 0 && errno == EINTR) continue;
+            if (n == 0) {
+                std::cerr << "The server closed a connection" << std::endl;
+                exit(1);
+            }
+            if (n < 0) break;
+            conn.input.append(buffer, n);
+        }
+
+        if (conn.hello_pending && !conn.input.empty()) {
+            conn.hello_pending = false;
+            if ((uint8_t)conn.input[0] != PROTOCOL_HELLO) {
+                std::cerr << "Server does not support the binary protocol" << std::endl;
+                exit(1);
+            }
+            conn.input.erase(0, 1);
+        }
+
+        // Responses come back in request order
+        size_t start = 0;
+        if (options_.binary) {
+            for (; conn.input.size() - start >= FRAME_SIZE; start += FRAME_SIZE) {
+                complete(conn.tcp_waiting, REQUEST_ADD, decodeFrame(conn.input.data() + start).status == STATUS_OK);
+            }
+        } else {
+            size_t newline;
+            while ((newline = conn.input.find("\r\n", start)) != std::string::npos) {
+                complete(conn.tcp_waiting, REQUEST_ADD, isSuccess(std::string_view(conn.input).substr(start, newline - start)));
+                start = newline + 2;
+            }
+        }
+        conn.input.erase(0, start);
+    }
+
+    void readUdp(Connection& conn) {
+        char buffer[1024];
+        ssize_t n;
+        while ((n = recv(conn.udp_fd, buffer, sizeof(buffer), 0)) >= 0 || errno == EINTR) {
+            if (n < 0) continue;
+            if (!options_.binary) {
+                // At most one text DELIVER is outstanding on the socket
+                if (!conn.udp_waiting.empty()) {
+                    completeDeliver(conn, conn.udp_waiting.front().first, isSuccess(std::string_view(buffer, n)));
+                }
+            } else if (n == (ssize_t)(1 + FRAME_SIZE)) {
+                Frame reply = decodeFrame(buffer + 1);
+                completeDeliver(conn, reply.request_id, reply.status == STATUS_OK);
+            } else {
+                results_.errors++;  // Not a reply frame, so not any request's answer
+            }
+        }
+    }
+
+    const Options& options_;
+    int first_;  // Index of the first connection among all workers
+    std::vector<Connection> connections_;
+    std::mt19937 random_;
+    int epoll_fd_ = -1;
+    Results results_;
+};
+
+// Latency at a percentile of sorted samples, in microseconds
+double percentile(const std::vector<uint64_t>& sorted, double fraction) {
+    if (sorted.empty()) return 0;
+    size_t rank = (size_t)(fraction * sorted.size());
+    return sorted[std::min(rank, sorted.size() - 1)] / 1000.0;
+}
+
+void report(const Options& options, std::vector<Worker*>& workers, double elapsed) {
+    Results total;
+    for (Worker* worker : workers) {
+        Results& results = worker->results();
+        for (int type = 0; type < REQUEST_TYPES; type++) {
+            total.latencies[type].insert(total.latencies[type].end(), results.latencies[type].begin(),
+                                         results.latencies[type].end());
+        }
+        total.sent += results.sent;
+        total.errors += results.errors;
+        total.lost += results.lost;
+        total.unsent += results.unsent;
+    }
+    uint64_t answered = total.latencies[REQUEST_ADD].size() + total.latencies[REQUEST_DELIVER].size();
+
+    std::cout << std::fixed << std::setprecision(1);
+    if (options.rate > 0) {
+        std::cout << "open loop at " << options.rate << " requests/s";
+    } else {
+        std::cout << "closed loop";
+    }
+    std::cout << ", " << options.connections << " connections, depth " << options.depth << ", "
+              << options.deliver_percent << "% DELIVER, " << (options.binary ? "binary" : "text") << std::endl;
+    std::cout << "sent " << total.sent << ", answered " << answered << " in " << elapsed << " s: "
+              << answered / elapsed << " requests/s, " << total.errors << " errors, " << total.lost << " lost, "
+              << total.unsent << " behind schedule" << std::endl;
+
+    for (int type = 0; type < REQUEST_TYPES; type++) {
+        std::vector<uint64_t>& latencies = total.latencies[type];
+        if (latencies.empty()) continue;
+        std::sort(latencies.begin(), latencies.end());
+        std::cout << std::left << std::setw(8) << REQUEST_NAMES[type] << std::right
+                  << " count=" << latencies.size()
+                  << " p50=" << percentile(latencies, 0.5) << "us"
+                  << " p99=" << percentile(latencies, 0.99) << "us"
+                  << " p999=" << percentile(latencies, 0.999) << "us"
+                  << " max=" << latencies.back() / 1000.0 << "us" << std::endl;
+    }
+    // A connection may end with one request waiting behind its last answer
+    if (total.unsent > (uint64_t)options.connections) {
+        std::cout << "The server could not keep up with the requested rate" << std::endl;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    Options options;
+
+    // Parse command-line options
+    int opt;
+    while ((opt = getopt(argc, argv, "c:t:r:p:m:d:bH:T:U:")) != -1) {
+        switch (opt) {
+            case 'c':
+                options.connections = atoi(optarg);
+                break;
+            case 't':
+                options.threads = atoi(optarg);
+                break;
+            case 'r':
+                options.rate = atof(optarg);
+                break;
+            case 'p':
+                options.depth = atoi(optarg);
+                break;
+            case 'm':
+                options.deliver_percent = atoi(optarg);
+                break;
+            case 'd':
+                options.duration = atof(optarg);
+                break;
+            case 'b':
+                options.binary = true;
+                break;
+            case 'H':
+                options.host = optarg;
+                break;
+            case 'T':
+                options.tcp_port = atoi(optarg);
+                break;
+            case 'U':
+                options.udp_port = atoi(optarg);
+                break;
+            default:
+                std::cerr << "Usage: " << argv[0] << " [-c connections] [-t threads] [-r rate] [-p depth]"
+                          << " [-m deliver percent] [-d seconds] [-b] [-H host] [-T tcp port] [-U udp port]" << std::endl;
+                std::cerr << "  -r  total requests per second (open loop); 0 sends as fast as answered" << std::endl;
+                std::cerr << "  -p  requests in flight per connection (text DELIVERs go one at a time)" << std::endl;
+                std::cerr << "  -m  percent of requests that are DELIVER over UDP, the rest are ADD over TCP" << std::endl;
+                return 1;
+        }
+    }
+    if (options.connections <= 0 || options.threads <= 0 || options.depth <= 0 || options.rate < 0 ||
+        options.deliver_percent < 0 || options.deliver_percent > 100 || options.duration <= 0) {
+        std::cerr << "Invalid option value" << std::endl;
+        return 1;
+    }
+    options.threads = std::min(options.threads, options.connections);
+
+    // Split the connections between the threads
+    std::vector<Worker*> workers;
+    int first = 0;
+    for (int i = 0; i < options.threads; i++) {
+        int count = options.connections / options.threads + (i < options.connections % options.threads ? 1 : 0);
+        workers.push_back(new Worker(options, first, count, (unsigned)i + 1));
+        first += count;
+        if (!workers.back()->connectAll()) return 1;
+    }
+
+    prctl(PR_SET_TIMERSLACK, 1UL);  // Wake up on schedule, not up to 50us late
+
+    uint64_t start = nowNs();
+    uint64_t end = start + (uint64_t)(options.duration * NS_PER_SECOND);
+    std::vector<std::thread> threads;
+    for (Worker* worker : workers) {
+        threads.emplace_back(&Worker::run, worker, start, end);
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    // Answers still arriving while draining count, so their time does too
+    report(options, workers, (nowNs() - start) / (double)NS_PER_SECOND);
+    for (Worker* worker : workers) {
+        delete worker;
+    }
+    return 0;
+}
@@ -0,0 +1,321 @@
+#ifndef ATOM_INVENTORY_H
+#define ATOM_INVENTORY_H
+
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <algorithm>
+#include <thread>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#include "commandParser.h"
+
+/**
+ * Atom counters split like a tcmalloc heap: a central pool and per-thread
+ * caches. A DELIVER is served from the caller's cache when it holds enough,
+ * touching only that cache's cache line; otherwise the cache refills from
+ * the pool in one batch that also covers the next deliveries. When the pool
+ * is too low to refill a cache, a delivery the cache cannot cover reserves
+ * its atoms straight from the pool instead. ADD puts atoms in the pool.
+ *
+ * The three pool counters do not fit in one word (each goes up to 10^18), so
+ * they share a cache line with a sequence number, seqlock style. A change to
+ * the pool makes the number odd with a compare-and-swap, writes the counters
+ * and makes it even again, so changes apply one at a time, all of a
+ * reservation or none of it. Waiters spin briefly, then yield. Reads take no
+ * lock: a reservation checks the counters first and commits only if no
+ * change came in between, and refuses only on counters read between two
+ * changes.
+ *
+ * Each cache has a mutex, which its thread takes to deliver from it or
+ * refill it. Atoms only ever move between the pool and the caches, so they
+ * are never delivered twice. A delivery the pool cannot cover moves every
+ * cache back into the pool, with all the cache mutexes held in order, before
+ * giving up, unless no cache has been given atoms since the last time that
+ * happened: the pool then holds every atom, and refusing right away keeps
+ * failing deliveries cheap when atoms run out. snapshot() also holds every
+ * cache mutex, so the pool plus the frozen caches is an exact total.
+ */
+class AtomInventory {
+public:
+    typedef std::array<long long, ATOM_TYPES> Counts;
+
+    // Caches, shared by threads beyond this many
+    static constexpr unsigned CACHE_SLOTS = 64;
+
+    // Atoms of a type a refill leaves in a cache, and the most it ever holds
+    static constexpr long long CACHE_REFILL = 256;
+    static constexpr long long CACHE_MAX = 1024;
+
+    // Pauses while waiting for another change to the pool before yielding the CPU
+    static constexpr unsigned BACKOFF_SPINS = 64;
+
+    explicit AtomInventory(long long limit) : limit_(limit) {}
+
+    AtomInventory(const AtomInventory&) = delete;
+    AtomInventory& operator=(const AtomInventory&) = delete;
+
+    // Add count atoms of one type, or none if the total would pass the limit
+    bool add(Atom atom, long long count) {
+        // Cached atoms are bounded, so far from the limit there is no need to count them
+        if (addToPool(atom, count, CACHE_SLOTS * CACHE_MAX)) return true;
+
+        lockCaches();
+        long long cached = 0;
+        for (const Cache& cache : caches_) {
+            cached += cache.atoms[atom].load(std::memory_order_relaxed);
+        }
+        bool added = addToPool(atom, count, cached);
+        unlockCaches();
+        return added;
+    }
+
+    // Take need[atom] atoms of every type, or none if there are not enough (or a need is negative)
+    bool take(const Counts& need) {
+        // Taking a negative count would add atoms past the limit
+        for (int atom = 0; atom < ATOM_TYPES; atom++) {
+            if (need[atom] < 0) return false;
+        }
+
+        Cache& cache = caches_[threadSlot()];
+        if (!covers(load(cache.atoms), need, 0) && !covers(load(pool_.atoms), need, CACHE_REFILL)) {
+            // Atoms are scarce: the cache cannot help, so leave it unlocked
+            Reservation reserved = takeFromPool(need, false);
+            if (reserved != SHORT) return reserved == RESERVED;
+        } else {
+            std::lock_guard<std::mutex> guard(cache.lock);
+            Counts held = load(cache.atoms);
+            if (covers(held, need, 0)) {
+                for (int atom = 0; atom < ATOM_TYPES; atom++) {
+                    if (need[atom] > 0) cache.atoms[atom].store(held[atom] - need[atom], std::memory_order_relaxed);
+                }
+                return true;
+            }
+
+            // Refill the types this delivery uses, or failing that take just what is missing
+            if (refill(cache, held, need, CACHE_REFILL) == RESERVED) return true;
+            Reservation missing = refill(cache, held, need, 0);
+            if (missing != SHORT) return missing == RESERVED;
+        }
+
+        // The pool is short, but caches may hold what is missing. Move every
+        // cache back into the pool and decide on the exact total
+        lockCaches();
+        unsigned long long seq = beginChange();
+        for (Cache& other : caches_) {
+            for (int atom = 0; atom < ATOM_TYPES; atom++) {
+                long long held = other.atoms[atom].exchange(0, std::memory_order_relaxed);
+                pool_.atoms[atom].store(pool_.atoms[atom].load(std::memory_order_relaxed) + held,
+                                        std::memory_order_relaxed);
+            }
+        }
+        pool_.caches_empty.store(true, std::memory_order_relaxed);
+        endChange(seq);
+        bool taken = takeFromPool(need, false) == RESERVED;
+        unlockCaches();
+        return taken;
+    }
+
+    // Atoms of one type, read without locking; for logging, not for decisions
+    long long count(Atom atom) const {
+        long long total = pool_.atoms[atom].load(std::memory_order_relaxed);
+        for (const Cache& cache : caches_) {
+            total += cache.atoms[atom].load(std::memory_order_relaxed);
+        }
+        return total;
+    }
+
+    // Every counter at one moment, with no delivery half done
+    Counts snapshot() {
+        lockCaches();
+        Counts total = readPool();
+        for (int atom = 0; atom < ATOM_TYPES; atom++) {
+            for (const Cache& cache : caches_) {
+                total[atom] += cache.atoms[atom].load(std::memory_order_relaxed);
+            }
+        }
+        unlockCaches();
+        return total;
+    }
+
+private:
+    // The pool's counters and the sequence number guarding them, on one cache
+    // line. The sequence number counts changes, times two, and is odd while
+    // one is being applied. caches_empty is set when every cache has been
+    // moved into the pool and cleared by the first reservation that leaves
+    // atoms in a cache again
+    struct alignas(64) Pool {
+        std::atomic<unsigned long long> sequence{0};
+        std::atomic<long long> atoms[ATOM_TYPES] = {};
+        std::atomic<bool> caches_empty{true};
+    };
+
+    // What a reservation from the pool found; EXHAUSTED means the pool was
+    // short while no cache held any atoms, so the whole inventory was
+    enum Reservation { RESERVED, SHORT, EXHAUSTED };
+
+    // A thread's atoms; written under lock, read without it by count() and
+    // by take() to decide whether to lock it
+    struct alignas(64) Cache {
+        std::mutex lock;
+        std::atomic<long long> atoms[ATOM_TYPES] = {};
+    };
+
+    // Cache of the calling thread; threads are numbered in order of first use
+    static unsigned threadSlot() {
+        static std::atomic<unsigned> next{0};
+        thread_local unsigned slot = next.fetch_add(1) % CACHE_SLOTS;
+        return slot;
+    }
+
+    static Counts load(const std::atomic<long long> (&atoms)[ATOM_TYPES]) {
+        Counts counts;
+        for (int atom = 0; atom < ATOM_TYPES; atom++) {
+            counts[atom] = atoms[atom].load(std::memory_order_relaxed);
+        }
+        return counts;
+    }
+
+    // Whether have holds need, plus spare more of every type need uses
+    static bool covers(const Counts& have, const Counts& need, long long spare) {
+        for (int atom = 0; atom < ATOM_TYPES; atom++) {
+            if (need[atom] > 0 && have[atom] < need[atom] + spare) return false;
+        }
+        return true;
+    }
+
+    // Deliver from the cache after taking what it lacks from the pool, plus
+    // enough that refill atoms of every type the delivery uses are left over.
+    // Called with the cache locked
+    Reservation refill(Cache& cache, const Counts& held, const Counts& need, long long refill) {
+        Counts left, want;
+        bool keeps = false;
+        for (int atom = 0; atom < ATOM_TYPES; atom++) {
+            left[atom] = std::max(held[atom] - need[atom], 0LL);
+            if (need[atom] > 0) left[atom] = std::max(left[atom], std::min(refill, CACHE_MAX));
+            want[atom] = need[atom] + left[atom] - held[atom];
+            keeps = keeps || left[atom] > 0;
+        }
+        Reservation reserved = takeFromPool(want, keeps);
+        if (reserved != RESERVED) return reserved;
+        for (int atom = 0; atom < ATOM_TYPES; atom++) {
+            cache.atoms[atom].store(left[atom], std::memory_order_relaxed);
+        }
+        return RESERVED;
+    }
+
+    // Take need[atom] atoms of every type from the pool, or none if any type is
+    // short. The counters are read and checked without writing, then the
+    // reservation commits by moving the sequence number to odd, which fails if
+    // the pool changed since they were read. A shortage is only reported when
+    // the sequence number shows the counters were read between two changes.
+    // to_cache says the atoms will stay in a cache
+    Reservation takeFromPool(const Counts& need, bool to_cache) {
+        unsigned waits = 0;
+        while (true) {
+            unsigned long long seq = pool_.sequence.load(std::memory_order_acquire);
+            if (seq & 1) {
+                backOff(waits);
+                continue;
+            }
+
+            Counts pool = load(pool_.atoms);
+            if (!covers(pool, need, 0)) {
+                bool exhausted = pool_.caches_empty.load(std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (pool_.sequence.load(std::memory_order_relaxed) == seq) return exhausted ? EXHAUSTED : SHORT;
+                continue;
+            }
+
+            if (pool_.sequence.compare_exchange_weak(seq, seq + 1, std::memory_order_acquire)) {
+                std::atomic_thread_fence(std::memory_order_release);
+                if (to_cache && pool_.caches_empty.load(std::memory_order_relaxed)) {
+                    pool_.caches_empty.store(false, std::memory_order_relaxed);
+                }
+                for (int atom = 0; atom < ATOM_TYPES; atom++) {
+                    if (need[atom] > 0) pool_.atoms[atom].store(pool[atom] - need[atom], std::memory_order_relaxed);
+                }
+                endChange(seq);
+                return RESERVED;
+            }
+        }
+    }
+
+    // Add count atoms to the pool if, with cached more in the caches, the
+    // total stays within the limit
+    bool addToPool(Atom atom, long long count, long long cached) {
+        unsigned long long seq = beginChange();
+        long long current = pool_.atoms[atom].load(std::memory_order_relaxed);
+        bool added = current <= limit_ - cached - count;
+        if (added) pool_.atoms[atom].store(current + count, std::memory_order_relaxed);
+        endChange(seq);
+        return added;
+    }
+
+    // The pool's counters at one moment
+    Counts readPool() const {
+        unsigned waits = 0;
+        while (true) {
+            unsigned long long seq = pool_.sequence.load(std::memory_order_acquire);
+            if (seq & 1) {
+                backOff(waits);
+                continue;
+            }
+            Counts pool = load(pool_.atoms);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (pool_.sequence.load(std::memory_order_relaxed) == seq) return pool;
+        }
+    }
+
+    // Wait for any other change to the pool and make the sequence number odd.
+    // Returns the even number it had, for endChange
+    unsigned long long beginChange() {
+        unsigned waits = 0;
+        unsigned long long seq = pool_.sequence.load(std::memory_order_relaxed);
+        while ((seq & 1) || !pool_.sequence.compare_exchange_weak(seq, seq + 1, std::memory_order_acquire)) {
+            if (seq & 1) {
+                backOff(waits);
+                seq = pool_.sequence.load(std::memory_order_relaxed);
+            }
+        }
+        std::atomic_thread_fence(std::memory_order_release);
+        return seq;
+    }
+
+    void endChange(unsigned long long seq) {
+        pool_.sequence.store(seq + 2, std::memory_order_release);
+    }
+
+    // Wait for a change to the pool being applied. It takes a few
+    // instructions, so spin briefly; past that its thread has likely been
+    // preempted mid-change, and only giving up the CPU lets it finish
+    static void backOff(unsigned& waits) {
+        if (++waits < BACKOFF_SPINS) {
+#if defined(__x86_64__) || defined(__i386__)
+            _mm_pause();
+#endif
+        } else {
+            std::this_thread::yield();
+        }
+    }
+
+    // Always in slot order, so that two threads locking them all cannot deadlock
+    void lockCaches() {
+        for (Cache& cache : caches_) {
+            cache.lock.lock();
+        }
+    }
+
+    void unlockCaches() {
+        for (Cache& cache : caches_) {
+            cache.lock.unlock();
+        }
+    }
+
+    const long long limit_;
+    Pool pool_;
+    Cache caches_[CACHE_SLOTS];
+};
+
+#endif
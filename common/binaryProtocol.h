@@ -0,0 +1,161 @@
+#ifndef BINARY_PROTOCOL_H
+#define BINARY_PROTOCOL_H
+
+#include "commandParser.h"
+
+#include <string>
+#include <string_view>
+#include <cstdint>
+#include <cstddef>
+
+/**
+ * Compact binary alternative to the text commands. A client opts in by
+ * sending PROTOCOL_HELLO as the first byte of a TCP connection, which the
+ * server acknowledges with the same byte; everything after it in both
+ * directions is a sequence of fixed-size frames. A UDP datagram is binary
+ * when it starts with PROTOCOL_HELLO and holds whole frames; the reply
+ * carries the hello byte and one response frame per request frame.
+ *
+ * Frame layout (FRAME_SIZE bytes, integers little-endian):
+ *   0      opcode      OPCODE_ADD, OPCODE_DELIVER or OPCODE_GEN
+ *   1      id          Atom for ADD, MoleculeId for DELIVER and GEN
+ *   2      status      FrameStatus in responses, 0 in requests
+ *   3      reserved    0
+ *   4..7   request id  chosen by the client, echoed in the response
+ *   8..15  count       atoms or molecules, echoed in the response
+ */
+
+// First byte of a binary connection or datagram; no text command starts with it
+const uint8_t PROTOCOL_HELLO = 0xB1;
+
+const size_t FRAME_SIZE = 16;
+
+enum Opcode : uint8_t { OPCODE_ADD = 1, OPCODE_DELIVER = 2, OPCODE_GEN = 3 };
+
+enum FrameStatus : uint8_t {
+    STATUS_OK,
+    STATUS_INVALID,      // Unknown opcode or id, or a count out of range
+    STATUS_LIMIT,        // ADD would pass the atom limit
+    STATUS_SHORTAGE,     // Not enough atoms for the molecules
+    STATUS_UNSUPPORTED   // The opcode is not served on this socket
+};
+
+struct Frame {
+    uint8_t opcode;
+    uint8_t id;
+    uint8_t status;
+    uint32_t request_id;
+    uint64_t count;
+};
+
+// Protocol of a connection, decided by its first byte
+enum Protocol { PROTOCOL_UNKNOWN, PROTOCOL_TEXT, PROTOCOL_BINARY };
+
+inline void appendFrame(std::string& out, const Frame& frame) {
+    char bytes[FRAME_SIZE] = {(char)frame.opcode, (char)frame.id, (char)frame.status, 0};
+    for (int i = 0; i < 4; i++) {
+        bytes[4 + i] = (char)(frame.request_id >> (8 * i));
+    }
+    for (int i = 0; i < 8; i++) {
+        bytes[8 + i] = (char)(frame.count >> (8 * i));
+    }
+    out.append(bytes, FRAME_SIZE);
+}
+
+inline Frame decodeFrame(const char* bytes) {
+    const unsigned char* b = reinterpret_cast<const unsigned char*>(bytes);
+    Frame frame = {b[0], b[1], b[2], 0, 0};
+    for (int i = 3; i >= 0; i--) {
+        frame.request_id = (frame.request_id << 8) | b[4 + i];
+    }
+    for (int i = 7; i >= 0; i--) {
+        frame.count = (frame.count << 8) | b[8 + i];
+    }
+    return frame;
+}
+
+/**
+ * Decide the protocol of a stream once its first byte has arrived. A binary
+ * hello is consumed from input and acknowledged in output.
+ */
+inline void negotiateProtocol(std::string& input, std::string& output, unsigned& protocol) {
+    if (protocol != PROTOCOL_UNKNOWN || input.empty()) return;
+    if ((uint8_t)input[0] == PROTOCOL_HELLO) {
+        protocol = PROTOCOL_BINARY;
+        input.erase(0, 1);
+        output.push_back((char)PROTOCOL_HELLO);
+    }
+    else {
+        protocol = PROTOCOL_TEXT;
+    }
+}
+
+/**
+ * Run every complete frame at the front of input through execute (a
+ * Frame(const Frame&) callable) and append the response frames to output.
+ * A partial frame stays in input.
+ */
+template <typename Execute>
+void processFrames(std::string& input, std::string& output, Execute execute) {
+    size_t offset = 0;
+    while (input.size() - offset >= FRAME_SIZE) {
+        appendFrame(output, execute(decodeFrame(input.data() + offset)));
+        offset += FRAME_SIZE;
+    }
+    input.erase(0, offset);
+}
+
+/**
+ * Check whether a datagram uses the binary protocol.
+ */
+inline bool isBinaryDatagram(const char* data, size_t size) {
+    return size > FRAME_SIZE && (uint8_t)data[0] == PROTOCOL_HELLO && (size - 1) % FRAME_SIZE == 0;
+}
+
+/**
+ * Reply to a binary datagram: the hello byte, then one response per frame.
+ */
+template <typename Execute>
+std::string processDatagram(const char* data, size_t size, Execute execute) {
+    std::string output(1, (char)PROTOCOL_HELLO);
+    for (size_t offset = 1; offset + FRAME_SIZE <= size; offset += FRAME_SIZE) {
+        appendFrame(output, execute(decodeFrame(data + offset)));
+    }
+    return output;
+}
+
+/**
+ * Translate a text command (ADD, DELIVER or GEN) into a request frame, for
+ * clients that speak the binary protocol.
+ * @return False if the command is malformed or names an unknown atom or molecule.
+ */
+inline bool commandToFrame(std::string_view command, uint32_t request_id, Frame& frame) {
+    frame = {0, 0, 0, request_id, 0};
+    Atom atom;
+    MoleculeId molecule = MOLECULE_TYPES;
+    if (parseAddCommand(command, atom, frame.count)) {
+        frame.opcode = OPCODE_ADD;
+        frame.id = (uint8_t)atom;
+        return true;
+    }
+    if (parseMoleculeCommand(command, "DELIVER", molecule, frame.count)) {
+        frame.opcode = OPCODE_DELIVER;
+    }
+    else if (parseMoleculeCommand(command, "GEN", molecule, frame.count)) {
+        frame.opcode = OPCODE_GEN;
+    }
+    frame.id = (uint8_t)molecule;
+    return frame.opcode != 0 && molecule != MOLECULE_TYPES;
+}
+
+/**
+ * Human-readable form of a response frame.
+ */
+inline std::string describeFrame(const Frame& frame) {
+    static const char* const STATUS_NAMES[] = {"OK", "invalid command", "atoms limit exceeded",
+                                               "not enough atoms", "unsupported on this socket"};
+    std::string text = frame.status <= STATUS_UNSUPPORTED ? STATUS_NAMES[frame.status] : "unknown status";
+    return text + " (request " + std::to_string(frame.request_id) + ", count " + std::to_string(frame.count) + ")";
+}
+
+#endif
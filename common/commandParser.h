@@ -0,0 +1,227 @@
+#ifndef COMMAND_PARSER_H
+#define COMMAND_PARSER_H
+
+#include <string_view>
+#include <charconv>
+#include <array>
+#include <cstdint>
+#include <cstddef>
+#include <type_traits>
+
+/**
+ * Allocation-free parsing of the ADD, DELIVER and GEN commands: words are
+ * string_views into the received line, counts are read with from_chars and
+ * names are resolved through perfect hash tables built at compile time.
+ */
+
+// Atom types, in the order the servers store their counters
+enum Atom { CARBON, OXYGEN, HYDROGEN, ATOM_TYPES };
+
+// Molecules any stage knows, sorted by name
+enum MoleculeId {
+    ALCOHOL,
+    CARBON_DIOXIDE,
+    CHAMPAGNE,
+    GLUCOSE,
+    SOFT_DRINK,
+    VODKA,
+    WATER,
+    MOLECULE_TYPES
+};
+
+constexpr std::array<std::string_view, ATOM_TYPES> ATOM_NAMES = {{"CARBON", "OXYGEN", "HYDROGEN"}};
+
+constexpr std::array<std::string_view, MOLECULE_TYPES> MOLECULE_NAMES = {
+    {"ALCOHOL", "CARBON DIOXIDE", "CHAMPAGNE", "GLUCOSE", "SOFT DRINK", "VODKA", "WATER"}};
+
+/**
+ * Seeded FNV-1a hash of a name, finished with the murmur3 mixer so that the
+ * low bits used as a slot depend on every bit of the seed and the name.
+ */
+constexpr uint32_t nameHash(std::string_view name, uint32_t seed) {
+    uint32_t hash = 2166136261u ^ (seed * 0x9e3779b9u);
+    for (char c : name) {
+        hash = (hash ^ (unsigned char)c) * 16777619u;
+    }
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bu;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35u;
+    return hash ^ (hash >> 16);
+}
+
+/**
+ * Perfect hash over a fixed set of names: the seed is searched at compile
+ * time so that every name lands in its own slot, and a lookup is one hash
+ * plus one comparison.
+ */
+template <size_t N, size_t SLOTS>
+class PerfectHash {
+    static_assert((SLOTS & (SLOTS - 1)) == 0 && SLOTS >= N, "SLOTS must be a power of two >= N");
+
+public:
+    constexpr explicit PerfectHash(const std::array<std::string_view, N>& names)
+        : names_(names), seed_(findSeed(names)), slots_() {
+        for (size_t i = 0; i < SLOTS; i++) {
+            slots_[i] = N;
+        }
+        for (size_t i = 0; i < N; i++) {
+            slots_[nameHash(names[i], seed_) & (SLOTS - 1)] = (uint8_t)i;
+        }
+    }
+
+    /**
+     * @return The index of name, or N if it is not one of the names.
+     */
+    constexpr size_t find(std::string_view name) const {
+        size_t index = slots_[nameHash(name, seed_) & (SLOTS - 1)];
+        return index < N && names_[index] == name ? index : N;
+    }
+
+private:
+    static constexpr uint32_t findSeed(const std::array<std::string_view, N>& names) {
+        for (uint32_t seed = 0;; seed++) {
+            bool used[SLOTS] = {};
+            bool collision = false;
+            for (size_t i = 0; i < N && !collision; i++) {
+                size_t slot = nameHash(names[i], seed) & (SLOTS - 1);
+                collision = used[slot];
+                used[slot] = true;
+            }
+            if (!collision) return seed;
+        }
+    }
+
+    std::array<std::string_view, N> names_;
+    uint32_t seed_;
+    std::array<uint8_t, SLOTS> slots_;
+};
+
+constexpr PerfectHash<ATOM_TYPES, 4> ATOM_TABLE(ATOM_NAMES);
+constexpr PerfectHash<MOLECULE_TYPES, 16> MOLECULE_TABLE(MOLECULE_NAMES);
+
+static_assert(ATOM_TABLE.find("HYDROGEN") == HYDROGEN, "atom table is broken");
+static_assert(MOLECULE_TABLE.find("SOFT DRINK") == SOFT_DRINK, "molecule table is broken");
+
+/**
+ * @return The atom with this name, or ATOM_TYPES.
+ */
+constexpr Atom findAtom(std::string_view name) {
+    return (Atom)ATOM_TABLE.find(name);
+}
+
+/**
+ * @return The molecule with this name, or MOLECULE_TYPES.
+ */
+constexpr MoleculeId findMolecule(std::string_view name) {
+    return (MoleculeId)MOLECULE_TABLE.find(name);
+}
+
+/**
+ * Splits a command line into space- or tab-separated words without copying.
+ */
+class Tokenizer {
+public:
+    explicit Tokenizer(std::string_view line) : rest_(line) {}
+
+    /**
+     * Take the next word.
+     * @return False if only blanks are left.
+     */
+    bool next(std::string_view& word) {
+        skipBlanks();
+        size_t end = 0;
+        while (end < rest_.size() && !isBlank(rest_[end])) {
+            end++;
+        }
+        word = rest_.substr(0, end);
+        rest_.remove_prefix(end);
+        return !word.empty();
+    }
+
+    /**
+     * The rest of the line without leading and trailing blanks.
+     */
+    std::string_view rest() {
+        skipBlanks();
+        std::string_view rest = rest_;
+        while (!rest.empty() && isBlank(rest.back())) {
+            rest.remove_suffix(1);
+        }
+        return rest;
+    }
+
+private:
+    static bool isBlank(char c) {
+        return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+    }
+
+    void skipBlanks() {
+        while (!rest_.empty() && isBlank(rest_.front())) {
+            rest_.remove_prefix(1);
+        }
+    }
+
+    std::string_view rest_;
+};
+
+/**
+ * Read a non-negative count that fills the whole word.
+ * @return False if word is not a number that fits in T.
+ */
+template <typename T>
+bool parseCount(std::string_view word, T& count) {
+    static_assert(std::is_integral<T>::value, "counts are integers");
+    if (word.empty() || word.front() < '0' || word.front() > '9') {
+        return false;  // from_chars would accept a minus sign
+    }
+    std::from_chars_result result = std::from_chars(word.data(), word.data() + word.size(), count);
+    return result.ec == std::errc() && result.ptr == word.data() + word.size();
+}
+
+/**
+ * Parse "ADD <atom> <count>".
+ * @return False if the command is malformed or names an unknown atom.
+ */
+template <typename T>
+bool parseAddCommand(std::string_view command, Atom& atom, T& count) {
+    Tokenizer tokens(command);
+    std::string_view word, name, amount, extra;
+    if (!tokens.next(word) || word != "ADD" || !tokens.next(name) || !tokens.next(amount) || tokens.next(extra)) {
+        return false;
+    }
+    atom = findAtom(name);
+    return atom != ATOM_TYPES && parseCount(amount, count);
+}
+
+/**
+ * Parse "<verb> <molecule> [count]" (DELIVER or GEN). Molecule names may
+ * contain spaces, so a trailing word starting with a digit is the count and
+ * everything before it the name; the count defaults to 1.
+ * @param molecule Receives the molecule, MOLECULE_TYPES if the name is unknown.
+ * @return False if the verb differs or the count is malformed.
+ */
+template <typename T>
+bool parseMoleculeCommand(std::string_view command, std::string_view verb, MoleculeId& molecule, T& count) {
+    Tokenizer tokens(command);
+    std::string_view word;
+    if (!tokens.next(word) || word != verb) {
+        return false;
+    }
+
+    std::string_view rest = tokens.rest();
+    std::string_view name = rest;
+    count = 1;
+    size_t last_space = rest.find_last_of(" \t");
+    if (last_space != std::string_view::npos && last_space + 1 < rest.size() &&
+        rest[last_space + 1] >= '0' && rest[last_space + 1] <= '9') {
+        if (!parseCount(rest.substr(last_space + 1), count)) {
+            return false;
+        }
+        name = Tokenizer(rest.substr(0, last_space)).rest();
+    }
+    molecule = findMolecule(name);
+    return true;
+}
+
+#endif
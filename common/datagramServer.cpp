@@ -0,0 +1,84 @@
+#include "datagramServer.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cerrno>
+#include <memory>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+namespace {
+
+// Buffers of one batch, reused by every batch
+struct Batch {
+    char buffers[DATAGRAM_BATCH][DATAGRAM_SIZE];
+    struct sockaddr_storage addresses[DATAGRAM_BATCH];
+    struct iovec receive_iov[DATAGRAM_BATCH];
+    struct mmsghdr received[DATAGRAM_BATCH];
+    std::string replies[DATAGRAM_BATCH];
+    struct iovec send_iov[DATAGRAM_BATCH];
+    struct mmsghdr outgoing[DATAGRAM_BATCH];
+};
+
+// Send every reply of a batch, as few sendmmsg() calls as possible
+void sendReplies(int fd, struct mmsghdr* messages, unsigned count) {
+    unsigned sent = 0;
+    while (sent < count) {
+        int n = sendmmsg(fd, messages + sent, count - sent, 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            sent++;  // The first unsent reply failed (e.g. the client went away): drop it, like a lost datagram
+            continue;
+        }
+        sent += n;
+    }
+}
+
+}  // namespace
+
+void runDatagramServer(int fd, const DatagramHandler& handler) {
+    // Too large for the stack of a server thread
+    std::unique_ptr<Batch> batch(new Batch());
+    for (unsigned i = 0; i < DATAGRAM_BATCH; i++) {
+        batch->receive_iov[i] = {batch->buffers[i], DATAGRAM_SIZE};
+    }
+
+    while (true) {
+        for (unsigned i = 0; i < DATAGRAM_BATCH; i++) {
+            struct msghdr& header = batch->received[i].msg_hdr;
+            header = {};
+            header.msg_name = &batch->addresses[i];
+            header.msg_namelen = sizeof(batch->addresses[i]);
+            header.msg_iov = &batch->receive_iov[i];
+            header.msg_iovlen = 1;
+        }
+
+        // Block for the first datagram, then take whatever else is queued
+        int received = recvmmsg(fd, batch->received, DATAGRAM_BATCH, MSG_WAITFORONE, nullptr);
+        if (received < 0) {
+            if (errno != EINTR) perror("recvmmsg");
+            continue;
+        }
+
+        unsigned replies = 0;
+        for (int i = 0; i < received; i++) {
+            size_t size = batch->received[i].msg_len;
+            if (size == 0) continue;
+
+            std::string& reply = batch->replies[replies];
+            reply.clear();
+            handler(std::string_view(batch->buffers[i], size), reply);
+            if (reply.empty()) continue;
+
+            batch->send_iov[replies] = {reply.data(), reply.size()};
+            struct msghdr& header = batch->outgoing[replies].msg_hdr;
+            header = {};
+            header.msg_name = &batch->addresses[i];
+            header.msg_namelen = batch->received[i].msg_hdr.msg_namelen;
+            header.msg_iov = &batch->send_iov[replies];
+            header.msg_iovlen = 1;
+            replies++;
+        }
+        sendReplies(fd, batch->outgoing, replies);
+    }
+}
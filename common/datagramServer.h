@@ -0,0 +1,29 @@
+#ifndef DATAGRAM_SERVER_H
+#define DATAGRAM_SERVER_H
+
+#include <string>
+#include <string_view>
+#include <functional>
+
+// Most datagrams received (and replies sent) per system call
+const unsigned DATAGRAM_BATCH = 64;
+
+// Bytes kept of each datagram
+const size_t DATAGRAM_SIZE = 1024;
+
+/**
+ * Handles one datagram and puts its reply, if any, in reply (which starts
+ * empty). Nothing is sent back while reply stays empty.
+ */
+typedef std::function<void(std::string_view datagram, std::string& reply)> DatagramHandler;
+
+/**
+ * Serve a bound UDP socket in batches: one recvmmsg() takes every datagram
+ * already queued (up to DATAGRAM_BATCH), the handler runs on each of them in
+ * turn, and one sendmmsg() sends all the replies. A lone datagram is still
+ * answered at once. Datagrams longer than DATAGRAM_SIZE are truncated, and
+ * empty ones are ignored. Does not return.
+ */
+void runDatagramServer(int fd, const DatagramHandler& handler);
+
+#endif
@@ -0,0 +1,170 @@
+// Contention benchmark of the atom inventory: the mutex-guarded counters
+// the servers used before against AtomInventory with its per-thread caches,
+// with 1 to 64 threads each adding atoms and delivering WATER (2 hydrogen,
+// 1 oxygen) and CARBON DIOXIDE (1 carbon, 2 oxygen). Reports the operations
+// per second of each and checks that no atom was created or lost. Then
+// every thread delivers from a stock that is never topped up until it is
+// refused, which checks that no delivery is refused while its atoms are there.
+//
+// Usage: inventoryBench [operations per thread]
+
+#include "atomInventory.h"
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <cstdlib>
+
+static const long long LIMIT = 1000000000000000000LL;
+
+// The counters as addAtoms and deliverMolecules kept them
+class MutexInventory {
+public:
+    bool add(Atom atom, long long count) {
+        std::lock_guard<std::mutex> guard(lock_);
+        if (counts_[atom] + count > LIMIT) return false;
+        counts_[atom] += count;
+        return true;
+    }
+
+    bool take(const AtomInventory::Counts& need) {
+        std::lock_guard<std::mutex> guard(lock_);
+        for (int atom = 0; atom < ATOM_TYPES; atom++) {
+            if (counts_[atom] < need[atom]) return false;
+        }
+        for (int atom = 0; atom < ATOM_TYPES; atom++) {
+            counts_[atom] -= need[atom];
+        }
+        return true;
+    }
+
+    AtomInventory::Counts snapshot() {
+        std::lock_guard<std::mutex> guard(lock_);
+        return {counts_[CARBON], counts_[OXYGEN], counts_[HYDROGEN]};
+    }
+
+private:
+    std::mutex lock_;
+    long long counts_[ATOM_TYPES] = {};
+};
+
+// What one thread did, to check the final counts against
+struct Tally {
+    long long added[ATOM_TYPES] = {};
+    long long taken[ATOM_TYPES] = {};
+};
+
+// Each thread cycles through adding every atom type and two deliveries
+template <typename Inventory>
+static void work(Inventory& inventory, unsigned long operations, Tally& tally) {
+    static const AtomInventory::Counts DELIVERIES[2] = {{0, 1, 2}, {1, 2, 0}};
+    for (unsigned long i = 0; i < operations; i++) {
+        unsigned step = i % 5;
+        if (step < ATOM_TYPES) {
+            Atom atom = (Atom)step;
+            if (inventory.add(atom, 2)) tally.added[atom] += 2;
+        }
+        else {
+            const AtomInventory::Counts& need = DELIVERIES[step - ATOM_TYPES];
+            if (inventory.take(need)) {
+                for (int atom = 0; atom < ATOM_TYPES; atom++) {
+                    tally.taken[atom] += need[atom];
+                }
+            }
+        }
+    }
+}
+
+// Run threads workers on a fresh inventory; ops/s, or -1 if atoms went astray
+template <typename Inventory>
+static double run(unsigned threads, unsigned long operations) {
+    Inventory inventory;
+    std::vector<Tally> tallies(threads);
+    std::vector<std::thread> workers;
+
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned t = 0; t < threads; t++) {
+        workers.emplace_back([&inventory, &tallies, t, operations] { work(inventory, operations, tallies[t]); });
+    }
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    for (int atom = 0; atom < ATOM_TYPES; atom++) {
+        long long expected = 0;
+        for (const Tally& tally : tallies) {
+            expected += tally.added[atom] - tally.taken[atom];
+        }
+        if (inventory.snapshot()[atom] != expected || expected < 0) return -1;
+    }
+    return threads * operations / seconds;
+}
+
+// Threads deliver from a fixed stock until each is refused once. The stock
+// only shrinks, so atoms still there after a refusal were there during it.
+// Returns false if a delivery was refused with its atoms available
+template <typename Inventory>
+static bool drains(unsigned threads) {
+    static const AtomInventory::Counts DELIVERIES[2] = {{0, 1, 2}, {1, 2, 0}};
+    Inventory inventory;
+    for (int atom = 0; atom < ATOM_TYPES; atom++) {
+        inventory.add((Atom)atom, 10000LL * threads + atom);
+    }
+
+    std::atomic<bool> spurious{false};
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < threads; t++) {
+        workers.emplace_back([&inventory, &spurious, t] {
+            for (unsigned long i = t;; i++) {
+                const AtomInventory::Counts& need = DELIVERIES[i % 2];
+                if (inventory.take(need)) continue;
+                AtomInventory::Counts left = inventory.snapshot();
+                bool there = true;
+                for (int atom = 0; atom < ATOM_TYPES; atom++) {
+                    there = there && left[atom] >= need[atom];
+                }
+                if (there) spurious = true;
+                return;
+            }
+        });
+    }
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    return !spurious;
+}
+
+// AtomInventory with the servers' limit, constructible like MutexInventory
+struct CachedInventory : AtomInventory {
+    CachedInventory() : AtomInventory(LIMIT) {}
+};
+
+int main(int argc, char* argv[]) {
+    unsigned long operations = argc > 1 ? strtoul(argv[1], nullptr, 10) : 1000000;
+    if (operations == 0) {
+        std::cerr << "Usage: " << argv[0] << " [operations per thread]" << std::endl;
+        return 1;
+    }
+
+    std::cout << "threads       mutex ops/s      cached ops/s" << std::endl;
+    for (unsigned threads = 1; threads <= 64; threads *= 2) {
+        double locked = run<MutexInventory>(threads, operations);
+        double cached = run<CachedInventory>(threads, operations);
+        if (locked < 0 || cached < 0) {
+            std::cerr << "Atom counts do not match what was added and taken" << std::endl;
+            return 1;
+        }
+        if (!drains<MutexInventory>(threads) || !drains<CachedInventory>(threads)) {
+            std::cerr << "A delivery was refused while its atoms were there" << std::endl;
+            return 1;
+        }
+        std::cout << std::setw(7) << threads << std::setw(18) << (unsigned long long)locked << std::setw(18)
+                  << (unsigned long long)cached << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,442 @@
+#include "ioUring.h"
+#include "logger.h"
+
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <cstdint>
+#include <atomic>
+#include <unordered_set>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+namespace {
+
+const unsigned RING_ENTRIES = 1024;       // Submission queue size
+const unsigned BUFFER_COUNT = 4096;       // Receive buffers in the provided buffer ring
+const unsigned BUFFER_SIZE = 16384;       // Bytes per receive buffer
+const unsigned short BUFFER_GROUP = 0;    // Buffer group id used by every recv
+const size_t OUTPUT_HIGH_WATER = 262144;  // Queued output that pauses a connection's receives
+
+std::atomic<unsigned long long> rejected(0);
+
+// What a completion belongs to, kept in the low bits of its user_data
+enum Operation : uint64_t { OP_ACCEPT = 0, OP_RECV = 1, OP_SEND = 2, OP_CANCEL = 3, OP_MASK = 3 };
+
+// A client connection served through the ring
+struct Connection {
+    int fd;
+    std::string input;    // Bytes received after the last complete command
+    std::string sending;  // Output of the send in flight
+    size_t sent = 0;      // Bytes of sending already written
+    std::string pending;  // Output produced while a send was in flight
+    unsigned state = 0;   // Owned by the StreamHandler
+    bool recv_armed = false;
+    bool send_in_flight = false;
+    bool paused = false;  // Receive cancelled until the output queue drains
+    bool closing = false;
+
+    size_t queued() const {
+        return sending.size() - sent + pending.size();
+    }
+};
+
+int ringSetup(unsigned entries, io_uring_params* params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+int ringEnter(int fd, unsigned submit, unsigned wait, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, submit, wait, flags, nullptr, 0);
+}
+
+int ringRegister(int fd, unsigned opcode, void* arg, unsigned count) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, count);
+}
+
+/**
+ * Minimal io_uring instance: mapped submission and completion rings plus a
+ * provided buffer ring for receives.
+ */
+class Ring {
+public:
+    ~Ring() {
+        if (buffers_ != nullptr) munmap(buffers_, BUFFER_COUNT * BUFFER_SIZE);
+        if (buf_ring_ != nullptr) munmap(buf_ring_, BUFFER_COUNT * sizeof(io_uring_buf));
+        if (sqes_ != nullptr) munmap(sqes_, params_.sq_entries * sizeof(io_uring_sqe));
+        if (cq_ptr_ != nullptr && cq_ptr_ != sq_ptr_) munmap(cq_ptr_, cq_size_);
+        if (sq_ptr_ != nullptr) munmap(sq_ptr_, sq_size_);
+        if (fd_ >= 0) close(fd_);
+    }
+
+    /**
+     * Create the ring and register the receive buffers.
+     * @return False (errno set) if the kernel does not support it.
+     */
+    bool open() {
+        // Completions are reaped in io_uring_enter() on this thread only;
+        // older kernels reject these hints, so retry without them
+        memset(&params_, 0, sizeof(params_));
+        params_.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN |
+                        IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+        params_.cq_entries = RING_ENTRIES * 8;  // Multishot requests complete many times
+        fd_ = ringSetup(RING_ENTRIES, &params_);
+        if (fd_ < 0 && errno == EINVAL) {
+            memset(&params_, 0, sizeof(params_));
+            params_.flags = IORING_SETUP_CQSIZE;
+            params_.cq_entries = RING_ENTRIES * 8;
+            fd_ = ringSetup(RING_ENTRIES, &params_);
+        }
+        if (fd_ < 0) return false;
+        if (!(params_.features & IORING_FEAT_NODROP)) {
+            errno = ENOSYS;
+            return false;
+        }
+
+        // Map the rings (one mapping holds both when the kernel allows it)
+        sq_size_ = params_.sq_off.array + params_.sq_entries * sizeof(unsigned);
+        cq_size_ = params_.cq_off.cqes + params_.cq_entries * sizeof(io_uring_cqe);
+        bool single = params_.features & IORING_FEAT_SINGLE_MMAP;
+        if (single && cq_size_ > sq_size_) sq_size_ = cq_size_;
+        sq_ptr_ = mmap(nullptr, sq_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+        if (sq_ptr_ == MAP_FAILED) {
+            sq_ptr_ = nullptr;
+            return false;
+        }
+        cq_ptr_ = single ? sq_ptr_
+                         : mmap(nullptr, cq_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_CQ_RING);
+        if (cq_ptr_ == MAP_FAILED) {
+            cq_ptr_ = nullptr;
+            return false;
+        }
+        void* sqes = mmap(nullptr, params_.sq_entries * sizeof(io_uring_sqe), PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES);
+        if (sqes == MAP_FAILED) return false;
+        sqes_ = static_cast<io_uring_sqe*>(sqes);
+
+        char* sq = static_cast<char*>(sq_ptr_);
+        char* cq = static_cast<char*>(cq_ptr_);
+        sq_head_ = reinterpret_cast<unsigned*>(sq + params_.sq_off.head);
+        sq_tail_ = reinterpret_cast<unsigned*>(sq + params_.sq_off.tail);
+        sq_mask_ = *reinterpret_cast<unsigned*>(sq + params_.sq_off.ring_mask);
+        cq_head_ = reinterpret_cast<unsigned*>(cq + params_.cq_off.head);
+        cq_tail_ = reinterpret_cast<unsigned*>(cq + params_.cq_off.tail);
+        cq_mask_ = *reinterpret_cast<unsigned*>(cq + params_.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params_.cq_off.cqes);
+
+        // Submission slots map one to one onto SQEs
+        unsigned* array = reinterpret_cast<unsigned*>(sq + params_.sq_off.array);
+        for (unsigned i = 0; i < params_.sq_entries; i++) {
+            array[i] = i;
+        }
+        local_tail_ = *sq_tail_;
+        return setupBuffers();
+    }
+
+    /**
+     * Next free SQE, cleared. Submits the queued ones first when the queue is full.
+     */
+    io_uring_sqe* getSqe() {
+        if (local_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >= params_.sq_entries) {
+            submit(0);
+        }
+        io_uring_sqe* sqe = &sqes_[local_tail_ & sq_mask_];
+        memset(sqe, 0, sizeof(*sqe));
+        local_tail_++;
+        return sqe;
+    }
+
+    /**
+     * Submit everything queued and wait for at least `wait` completions.
+     * @return False on a fatal error.
+     */
+    bool submit(unsigned wait) {
+        unsigned queued = local_tail_ - *sq_tail_;
+        __atomic_store_n(sq_tail_, local_tail_, __ATOMIC_RELEASE);
+        while (true) {
+            int ret = ringEnter(fd_, queued, wait, wait > 0 ? IORING_ENTER_GETEVENTS : 0);
+            if (ret >= 0) return true;
+            if (errno == EINTR) {
+                queued = 0;  // Interrupted calls consumed nothing we have to resend
+                continue;
+            }
+            // Completions must be reaped before more can be submitted
+            return errno == EBUSY || errno == EAGAIN;
+        }
+    }
+
+    /**
+     * Oldest unread completion, or nullptr.
+     */
+    io_uring_cqe* peek() {
+        unsigned head = *cq_head_;
+        if (head == __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) return nullptr;
+        return &cqes_[head & cq_mask_];
+    }
+
+    void consume() {
+        __atomic_store_n(cq_head_, *cq_head_ + 1, __ATOMIC_RELEASE);
+    }
+
+    const char* buffer(unsigned short id) const {
+        return buffers_ + (size_t)id * BUFFER_SIZE;
+    }
+
+    /**
+     * Hand a receive buffer back to the kernel.
+     */
+    void recycleBuffer(unsigned short id) {
+        // The entries start at the ring itself (the tail overlays the first
+        // one's reserved field); the bufs member is misplaced when the kernel
+        // header is compiled as C++, so it is not used
+        io_uring_buf* buf = reinterpret_cast<io_uring_buf*>(buf_ring_) + (buf_tail_ & (BUFFER_COUNT - 1));
+        buf->addr = reinterpret_cast<uint64_t>(buffer(id));
+        buf->len = BUFFER_SIZE;
+        buf->bid = id;
+        buf_tail_++;
+        __atomic_store_n(&buf_ring_->tail, buf_tail_, __ATOMIC_RELEASE);
+    }
+
+private:
+    // Register BUFFER_COUNT receive buffers as a provided buffer ring
+    bool setupBuffers() {
+        void* ring = mmap(nullptr, BUFFER_COUNT * sizeof(io_uring_buf), PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        void* data = mmap(nullptr, (size_t)BUFFER_COUNT * BUFFER_SIZE, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (ring == MAP_FAILED || data == MAP_FAILED) {
+            if (ring != MAP_FAILED) munmap(ring, BUFFER_COUNT * sizeof(io_uring_buf));
+            if (data != MAP_FAILED) munmap(data, (size_t)BUFFER_COUNT * BUFFER_SIZE);
+            return false;
+        }
+        buf_ring_ = static_cast<io_uring_buf_ring*>(ring);
+        buffers_ = static_cast<char*>(data);
+
+        io_uring_buf_reg reg;
+        memset(&reg, 0, sizeof(reg));
+        reg.ring_addr = reinterpret_cast<uint64_t>(ring);
+        reg.ring_entries = BUFFER_COUNT;
+        reg.bgid = BUFFER_GROUP;
+        if (ringRegister(fd_, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) return false;
+
+        buf_tail_ = 0;
+        for (unsigned i = 0; i < BUFFER_COUNT; i++) {
+            recycleBuffer((unsigned short)i);
+        }
+        return true;
+    }
+
+    int fd_ = -1;
+    io_uring_params params_;
+    void* sq_ptr_ = nullptr;
+    void* cq_ptr_ = nullptr;
+    size_t sq_size_ = 0, cq_size_ = 0;
+    io_uring_sqe* sqes_ = nullptr;
+    unsigned* sq_head_ = nullptr;
+    unsigned* sq_tail_ = nullptr;
+    unsigned sq_mask_ = 0;
+    unsigned local_tail_ = 0;  // Tail including SQEs not yet published
+    unsigned* cq_head_ = nullptr;
+    unsigned* cq_tail_ = nullptr;
+    unsigned cq_mask_ = 0;
+    io_uring_cqe* cqes_ = nullptr;
+    io_uring_buf_ring* buf_ring_ = nullptr;
+    unsigned short buf_tail_ = 0;
+    char* buffers_ = nullptr;
+};
+
+uint64_t tag(Connection* conn, Operation op) {
+    return reinterpret_cast<uint64_t>(conn) | op;
+}
+
+void armAccept(Ring& ring, int listen_fd) {
+    io_uring_sqe* sqe = ring.getSqe();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listen_fd;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = OP_ACCEPT;
+}
+
+void armRecv(Ring& ring, Connection* conn) {
+    io_uring_sqe* sqe = ring.getSqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn->fd;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUFFER_GROUP;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->user_data = tag(conn, OP_RECV);
+    conn->recv_armed = true;
+}
+
+// Send the rest of conn->sending
+void armSend(Ring& ring, Connection* conn) {
+    io_uring_sqe* sqe = ring.getSqe();
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = conn->fd;
+    sqe->addr = reinterpret_cast<uint64_t>(conn->sending.data() + conn->sent);
+    sqe->len = (unsigned)(conn->sending.size() - conn->sent);
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = tag(conn, OP_SEND);
+    conn->send_in_flight = true;
+}
+
+// Start sending the pending output if no send is in flight
+void flushPending(Ring& ring, Connection* conn) {
+    if (conn->send_in_flight || conn->pending.empty()) return;
+    conn->sending.swap(conn->pending);
+    conn->pending.clear();
+    conn->sent = 0;
+    armSend(ring, conn);
+}
+
+// Stop receiving from a client that does not read its responses: cancel
+// its multishot recv once the queued output passes OUTPUT_HIGH_WATER, and
+// arm a new one when the queue has drained below it again
+void applyBackpressure(Ring& ring, Connection* conn) {
+    if (!conn->paused && conn->recv_armed && conn->queued() > OUTPUT_HIGH_WATER) {
+        io_uring_sqe* sqe = ring.getSqe();
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->addr = tag(conn, OP_RECV);
+        sqe->user_data = OP_CANCEL;
+        conn->paused = true;
+    }
+    else if (conn->paused && conn->queued() <= OUTPUT_HIGH_WATER) {
+        conn->paused = false;
+        if (!conn->recv_armed && !conn->closing) armRecv(ring, conn);
+    }
+}
+
+// Close a connection once its output is out and no request refers to it.
+// shutdown() ends the multishot recv, whose last completion lands here again
+void finishClosing(Connection* conn, std::unordered_set<Connection*>& connections, const ConnectionObserver& observer) {
+    if (conn->send_in_flight || !conn->pending.empty()) return;
+    if (conn->recv_armed) {
+        shutdown(conn->fd, SHUT_RDWR);
+        return;
+    }
+    close(conn->fd);
+    connections.erase(conn);
+    delete conn;
+    if (observer) observer(false);
+}
+
+// Serve clients until the ring fails. The connections still open then are
+// left in connections, their sockets closed, to be freed after the ring
+void serveRing(int listen_fd, const StreamHandler& handler, unsigned max_connections,
+               const ConnectionObserver& observer, std::unordered_set<Connection*>& connections) {
+    Ring ring;
+    if (!ring.open()) {
+        perror("io_uring");
+        return;
+    }
+    armAccept(ring, listen_fd);
+
+    while (ring.submit(1)) {
+        io_uring_cqe* cqe;
+        while ((cqe = ring.peek()) != nullptr) {
+            uint64_t data = cqe->user_data;
+            int res = cqe->res;
+            unsigned flags = cqe->flags;
+            ring.consume();
+
+            Connection* conn = reinterpret_cast<Connection*>(data & ~(uint64_t)OP_MASK);
+            switch (data & OP_MASK) {
+                case OP_ACCEPT:
+                    if (res >= 0 && connections.size() >= max_connections) {
+                        close(res);
+                        rejected.fetch_add(1, std::memory_order_relaxed);
+                    }
+                    else if (res >= 0) {
+                        Connection* client = new Connection();
+                        client->fd = res;
+                        connections.insert(client);
+                        armRecv(ring, client);
+                        if (observer) observer(true);
+                    }
+                    else if (res != -EINTR && res != -ECONNABORTED) {
+                        LOG_ERROR("accept: " << strerror(-res));
+                    }
+                    if (!(flags & IORING_CQE_F_MORE)) armAccept(ring, listen_fd);
+                    break;
+
+                case OP_RECV:
+                    if (!(flags & IORING_CQE_F_MORE)) conn->recv_armed = false;
+                    if (res > 0 && (flags & IORING_CQE_F_BUFFER)) {
+                        unsigned short id = (unsigned short)(flags >> IORING_CQE_BUFFER_SHIFT);
+                        if (!conn->closing) {
+                            conn->input.append(ring.buffer(id), res);
+                            conn->closing = !handler(conn->input, conn->pending, conn->state);
+                        }
+                        ring.recycleBuffer(id);
+                        flushPending(ring, conn);
+                        applyBackpressure(ring, conn);
+                    }
+                    else if (res != -ENOBUFS && res != -ECANCELED) {
+                        conn->closing = true;  // End of stream or error
+                    }
+                    // Out of buffers, stopped by the kernel or unpaused before
+                    // the cancellation landed: start again
+                    if (!conn->recv_armed && !conn->closing && !conn->paused) armRecv(ring, conn);
+                    if (conn->closing) finishClosing(conn, connections, observer);
+                    break;
+
+                case OP_SEND:
+                    conn->send_in_flight = false;
+                    if (res < 0) {
+                        conn->pending.clear();
+                        conn->closing = true;
+                    }
+                    else {
+                        conn->sent += res;
+                        if (conn->sent < conn->sending.size()) {
+                            armSend(ring, conn);  // Short send: write the rest
+                        }
+                        else {
+                            flushPending(ring, conn);
+                        }
+                        applyBackpressure(ring, conn);
+                    }
+                    if (conn->closing) finishClosing(conn, connections, observer);
+                    break;
+
+                case OP_CANCEL:
+                    break;  // The cancelled recv completes with -ECANCELED
+            }
+        }
+    }
+    perror("io_uring_enter");
+    for (Connection* conn : connections) {
+        close(conn->fd);
+    }
+}
+
+}  // namespace
+
+bool uringAvailable() {
+    static int available = -1;
+    if (available < 0) {
+        Ring probe;
+        available = probe.open();
+    }
+    return available == 1;
+}
+
+void runUringServer(int listen_fd, const StreamHandler& handler, unsigned max_connections,
+                    const ConnectionObserver& observer) {
+    std::unordered_set<Connection*> connections;
+    serveRing(listen_fd, handler, max_connections, observer, connections);
+
+    // The ring is gone, and with it every request pointing into a connection
+    for (Connection* conn : connections) {
+        delete conn;
+        if (observer) observer(false);
+    }
+}
+
+unsigned long long uringRejectedConnections() {
+    return rejected.load(std::memory_order_relaxed);
+}
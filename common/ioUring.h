@@ -0,0 +1,34 @@
+#ifndef IO_URING_SERVER_H
+#define IO_URING_SERVER_H
+
+#include "streamHandler.h"
+
+/**
+ * Check whether the running kernel offers what runUringServer needs
+ * (io_uring with provided buffer rings, multishot accept and recv).
+ */
+bool uringAvailable();
+
+/**
+ * Serve the connections of a listening TCP socket on the calling thread with
+ * io_uring: one multishot accept, one multishot recv per connection that
+ * takes its buffers from a provided buffer ring, and sends queued in the same
+ * submission as the receives that produced them, so a busy loop needs about
+ * one io_uring_enter() per batch of completions instead of syscalls per
+ * command.
+ * Only returns if io_uring cannot be used (check uringAvailable() first to
+ * fall back to another event loop) or on a fatal ring error, after closing
+ * every connection it served.
+ * @param max_connections Connections served at once; further ones are
+ *        accepted and closed right away.
+ * @param observer Optional, called for every connection opened and closed.
+ */
+void runUringServer(int listen_fd, const StreamHandler& handler, unsigned max_connections,
+                    const ConnectionObserver& observer = nullptr);
+
+/**
+ * Connections closed on arrival because max_connections were open.
+ */
+unsigned long long uringRejectedConnections();
+
+#endif
@@ -0,0 +1,228 @@
+#include "logger.h"
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
+#include <algorithm>
+#include <cstdlib>
+#include <cerrno>
+#include <unistd.h>
+
+std::atomic<int> log_level(LOG_LEVEL_INFO);
+
+namespace {
+
+const size_t RING_SIZE = 32768;  // Bytes buffered per thread (a power of two)
+const size_t MAX_LINE = 1024;    // Longer lines are truncated
+const std::chrono::milliseconds FLUSH_INTERVAL(10);
+
+/**
+ * Lines queued by one thread. Only the owning thread moves tail and only
+ * the flusher moves head, so neither side needs a lock.
+ */
+struct LogRing {
+    char data[RING_SIZE];
+    alignas(64) std::atomic<size_t> head{0};  // Apart from tail, so the two sides do not share a cache line
+    alignas(64) std::atomic<size_t> tail{0};
+    std::atomic<unsigned long long> dropped{0};  // Rate limited or ring full
+    std::atomic<bool> retired{false};            // The thread has exited
+};
+
+// Formats into a fixed line buffer; characters past its end are discarded
+class LineBuffer : public std::streambuf {
+public:
+    void reset() {
+        setp(line_, line_ + MAX_LINE - 1);  // Keep room for the newline
+    }
+
+    // Terminate the line and return its length
+    size_t finish() {
+        *pptr() = '\n';
+        return pptr() + 1 - line_;
+    }
+
+    const char* line() const {
+        return line_;
+    }
+
+protected:
+    int_type overflow(int_type c) override {
+        return traits_type::not_eof(c);
+    }
+
+private:
+    char line_[MAX_LINE];
+};
+
+// Logging state of one thread
+struct ThreadLog {
+    LogRing* ring = nullptr;
+    LineBuffer buffer;
+    std::ostream stream{&buffer};
+    unsigned tokens = 0;  // Lines left before the next refill
+    std::chrono::steady_clock::time_point refilled;
+
+    ~ThreadLog() {
+        if (ring != nullptr) ring->retired.store(true, std::memory_order_release);
+    }
+};
+
+std::atomic<unsigned> log_rate(DEFAULT_LOG_RATE);
+
+std::mutex rings_lock;  // Guards the list of rings, not their contents
+std::vector<LogRing*> rings;
+
+std::mutex flusher_lock;
+std::condition_variable flusher_wakeup;
+std::thread flusher;
+bool stopping = false;
+
+thread_local ThreadLog thread_log;
+
+// Ring of the calling thread, registered on first use
+LogRing* threadRing() {
+    if (thread_log.ring == nullptr) {
+        thread_log.ring = new LogRing();
+        std::lock_guard<std::mutex> guard(rings_lock);
+        rings.push_back(thread_log.ring);
+    }
+    return thread_log.ring;
+}
+
+// Move everything queued to out and free the rings of exited threads
+void drainRings(std::string& out) {
+    std::lock_guard<std::mutex> guard(rings_lock);
+    for (auto it = rings.begin(); it != rings.end();) {
+        LogRing* ring = *it;
+        bool retired = ring->retired.load(std::memory_order_acquire);  // Before reading tail
+
+        size_t head = ring->head.load(std::memory_order_relaxed);
+        size_t tail = ring->tail.load(std::memory_order_acquire);
+        for (size_t pos = head; pos != tail;) {
+            size_t offset = pos & (RING_SIZE - 1);
+            size_t chunk = std::min(tail - pos, RING_SIZE - offset);
+            out.append(ring->data + offset, chunk);
+            pos += chunk;
+        }
+        ring->head.store(tail, std::memory_order_release);
+
+        unsigned long long dropped = ring->dropped.exchange(0, std::memory_order_relaxed);
+        if (dropped > 0) {
+            out += "[" + std::to_string(dropped) + " log lines dropped]\n";
+        }
+
+        if (retired) {
+            delete ring;
+            it = rings.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void writeOut(const std::string& out) {
+    size_t done = 0;
+    while (done < out.size()) {
+        ssize_t n = write(STDOUT_FILENO, out.data() + done, out.size() - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return;
+        done += n;
+    }
+}
+
+void flushLoop() {
+    std::string out;
+    std::unique_lock<std::mutex> lock(flusher_lock);
+    while (!stopping) {
+        flusher_wakeup.wait_for(lock, FLUSH_INTERVAL);
+        lock.unlock();
+        out.clear();
+        drainRings(out);
+        writeOut(out);
+        lock.lock();
+    }
+}
+
+}  // namespace
+
+void startLogger(LogLevel level, unsigned rate) {
+    log_level.store(level);
+    log_rate.store(rate);
+
+    std::lock_guard<std::mutex> guard(flusher_lock);
+    if (!flusher.joinable()) {
+        stopping = false;
+        flusher = std::thread(flushLoop);
+        static bool registered = false;
+        if (!registered) {
+            atexit(stopLogger);
+            registered = true;
+        }
+    }
+}
+
+void stopLogger() {
+    {
+        std::lock_guard<std::mutex> guard(flusher_lock);
+        stopping = true;
+    }
+    flusher_wakeup.notify_all();
+    if (flusher.joinable() && flusher.get_id() != std::this_thread::get_id()) {
+        flusher.join();
+    }
+
+    std::string out;
+    drainRings(out);
+    writeOut(out);
+}
+
+bool takeLogToken() {
+    unsigned rate = log_rate.load(std::memory_order_relaxed);
+    if (rate == 0) return true;
+
+    ThreadLog& log = thread_log;
+    if (log.tokens == 0) {
+        // Refill with the lines earned since the last refill, up to one second's worth
+        auto now = std::chrono::steady_clock::now();
+        long long elapsed = std::chrono::duration_cast<std::chrono::microseconds>(now - log.refilled).count();
+        unsigned long long earned = (unsigned long long)elapsed * rate / 1000000;
+        if (earned == 0) {
+            threadRing()->dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        log.tokens = (unsigned)std::min<unsigned long long>(earned, rate);
+        log.refilled = now;
+    }
+    log.tokens--;
+    return true;
+}
+
+std::ostream& beginLogLine() {
+    thread_log.buffer.reset();
+    return thread_log.stream;
+}
+
+void endLogLine() {
+    ThreadLog& log = thread_log;
+    size_t length = log.buffer.finish();
+
+    LogRing* ring = threadRing();
+    size_t tail = ring->tail.load(std::memory_order_relaxed);
+    size_t head = ring->head.load(std::memory_order_acquire);
+    if (RING_SIZE - (tail - head) < length) {
+        ring->dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    const char* line = log.buffer.line();
+    for (size_t copied = 0; copied < length;) {
+        size_t offset = (tail + copied) & (RING_SIZE - 1);
+        size_t chunk = std::min(length - copied, RING_SIZE - offset);
+        std::copy(line + copied, line + copied + chunk, ring->data + offset);
+        copied += chunk;
+    }
+    ring->tail.store(tail + length, std::memory_order_release);
+}
@@ -0,0 +1,71 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <ostream>
+#include <atomic>
+
+/**
+ * Asynchronous logger. Every thread formats its lines into a fixed buffer
+ * and appends them to its own lock-free ring; a background thread drains
+ * the rings to stdout. Logging never takes a lock or flushes, so it can be
+ * used on hot paths and while holding other locks. Lines are dropped (and
+ * counted) when a thread passes its rate limit or fills its ring.
+ *
+ * Use the LOG_* macros: when a level is disabled or the rate limit is hit
+ * the message expression is not evaluated at all.
+ */
+
+enum LogLevel { LOG_LEVEL_ERROR, LOG_LEVEL_WARN, LOG_LEVEL_INFO, LOG_LEVEL_DEBUG };
+
+// Lines a thread may log per second before further ones are dropped
+const unsigned DEFAULT_LOG_RATE = 100000;
+
+/**
+ * Start the flusher thread. Lines logged before are kept until it runs.
+ * The logger is flushed and stopped at exit.
+ * @param level The most verbose level written.
+ * @param rate Lines per second allowed per thread (0 = unlimited).
+ */
+void startLogger(LogLevel level, unsigned rate = DEFAULT_LOG_RATE);
+
+/**
+ * Write everything logged so far and stop the flusher thread.
+ */
+void stopLogger();
+
+// Most verbose level written; read without synchronization on every call
+extern std::atomic<int> log_level;
+
+/**
+ * Check the rate limit of the calling thread and take one line from it.
+ */
+bool takeLogToken();
+
+inline bool logEnabled(LogLevel level) {
+    return level <= log_level.load(std::memory_order_relaxed) && takeLogToken();
+}
+
+/**
+ * Stream formatting into the calling thread's line buffer.
+ */
+std::ostream& beginLogLine();
+
+/**
+ * Queue the line formatted since beginLogLine().
+ */
+void endLogLine();
+
+#define LOG_AT(level, message)                   \
+    do {                                         \
+        if (logEnabled(level)) {                 \
+            beginLogLine() << message;           \
+            endLogLine();                        \
+        }                                        \
+    } while (0)
+
+#define LOG_ERROR(message) LOG_AT(LOG_LEVEL_ERROR, message)
+#define LOG_WARN(message) LOG_AT(LOG_LEVEL_WARN, message)
+#define LOG_INFO(message) LOG_AT(LOG_LEVEL_INFO, message)
+#define LOG_DEBUG(message) LOG_AT(LOG_LEVEL_DEBUG, message)
+
+#endif
@@ -0,0 +1,224 @@
+#include "metrics.h"
+
+#include <atomic>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <algorithm>
+#include <memory>
+#include <cstdio>
+
+namespace {
+
+const unsigned SUB_BUCKET_BITS = 4;
+const uint64_t SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+const unsigned MAX_EXPONENT = 40;  // Values are clamped below 2^41 ns
+const uint64_t MAX_VALUE = (2ULL << MAX_EXPONENT) - 1;
+const size_t BUCKETS = SUB_BUCKETS + (MAX_EXPONENT - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+const char* const COUNTER_NAMES[COUNTERS] = {
+    "commands_add", "commands_deliver", "commands_gen", "commands_stats", "errors",
+    "bytes_in", "bytes_out", "connections_total", "disconnections_total"
+};
+
+const char* const LATENCY_NAMES[LATENCIES] = {"latency_add_ns", "latency_deliver_ns", "latency_gen_ns"};
+
+const auto started = std::chrono::steady_clock::now();
+
+size_t bucketOf(uint64_t value) {
+    value = std::min(value, MAX_VALUE);
+    if (value < SUB_BUCKETS) return value;
+    unsigned exponent = 63 - __builtin_clzll(value);
+    uint64_t sub = (value >> (exponent - SUB_BUCKET_BITS)) - SUB_BUCKETS;
+    return SUB_BUCKETS + (exponent - SUB_BUCKET_BITS) * SUB_BUCKETS + sub;
+}
+
+// Largest value that falls in a bucket
+uint64_t bucketTop(size_t bucket) {
+    if (bucket < SUB_BUCKETS) return bucket;
+    unsigned shift = (unsigned)((bucket - SUB_BUCKETS) / SUB_BUCKETS);
+    uint64_t sub = (bucket - SUB_BUCKETS) % SUB_BUCKETS;
+    return ((SUB_BUCKETS + sub + 1) << shift) - 1;
+}
+
+// Increment a value only its own thread writes, without a locked instruction
+void bump(std::atomic<uint64_t>& value, uint64_t n) {
+    value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+struct Histogram {
+    std::atomic<uint64_t> buckets[BUCKETS] = {};
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> sum{0};
+    std::atomic<uint64_t> max{0};
+};
+
+// Metrics recorded by one thread
+struct MetricsBlock {
+    std::atomic<uint64_t> counters[COUNTERS] = {};
+    Histogram latencies[LATENCIES];
+};
+
+// Plain sums of any number of blocks
+struct Totals {
+    uint64_t counters[COUNTERS] = {};
+    uint64_t buckets[LATENCIES][BUCKETS] = {};
+    uint64_t count[LATENCIES] = {};
+    uint64_t sum[LATENCIES] = {};
+    uint64_t max[LATENCIES] = {};
+
+    void add(const MetricsBlock& block) {
+        for (int i = 0; i < COUNTERS; i++) {
+            counters[i] += block.counters[i].load(std::memory_order_relaxed);
+        }
+        for (int l = 0; l < LATENCIES; l++) {
+            const Histogram& histogram = block.latencies[l];
+            for (size_t b = 0; b < BUCKETS; b++) {
+                buckets[l][b] += histogram.buckets[b].load(std::memory_order_relaxed);
+            }
+            count[l] += histogram.count.load(std::memory_order_relaxed);
+            sum[l] += histogram.sum.load(std::memory_order_relaxed);
+            max[l] = std::max(max[l], histogram.max.load(std::memory_order_relaxed));
+        }
+    }
+
+    // Smallest bucket top that at least fraction of the values do not exceed
+    uint64_t percentile(int latency, double fraction) const {
+        uint64_t rank = (uint64_t)(fraction * count[latency] + 0.5);
+        rank = std::max<uint64_t>(rank, 1);
+        uint64_t seen = 0;
+        for (size_t b = 0; b < BUCKETS; b++) {
+            seen += buckets[latency][b];
+            if (seen >= rank) return std::min(bucketTop(b), max[latency]);
+        }
+        return max[latency];
+    }
+};
+
+std::mutex blocks_lock;  // Guards blocks and retired, not the blocks' contents
+std::vector<MetricsBlock*> blocks;
+Totals retired;  // What exited threads recorded
+
+std::mutex gauges_lock;
+std::vector<std::pair<std::vector<std::string>, std::function<std::vector<uint64_t>()>>> gauges;
+
+// Registers the calling thread's block on first use; at thread exit its
+// values move to retired so that nothing recorded is lost
+struct ThreadMetrics {
+    MetricsBlock* block = nullptr;
+
+    MetricsBlock& get() {
+        if (block == nullptr) {
+            block = new MetricsBlock();
+            std::lock_guard<std::mutex> guard(blocks_lock);
+            blocks.push_back(block);
+        }
+        return *block;
+    }
+
+    ~ThreadMetrics() {
+        if (block == nullptr) return;
+        std::lock_guard<std::mutex> guard(blocks_lock);
+        retired.add(*block);
+        blocks.erase(std::find(blocks.begin(), blocks.end(), block));
+        delete block;
+    }
+};
+
+thread_local ThreadMetrics thread_metrics;
+
+// Dumps reports until the process exits
+void dumpLoop(std::string path, unsigned period) {
+    std::string temporary = path + ".tmp";
+    while (true) {
+        std::this_thread::sleep_for(std::chrono::seconds(period));
+        std::string report = formatMetrics();
+        FILE* file = fopen(temporary.c_str(), "w");
+        if (file == nullptr) {
+            perror("metrics dump");
+            continue;
+        }
+        bool written = fwrite(report.data(), 1, report.size(), file) == report.size();
+        if (fclose(file) != 0 || !written || rename(temporary.c_str(), path.c_str()) != 0) {
+            perror("metrics dump");
+        }
+    }
+}
+
+}  // namespace
+
+void countEvent(Counter counter, uint64_t n) {
+    bump(thread_metrics.get().counters[counter], n);
+}
+
+void recordLatency(Latency latency, uint64_t nanoseconds) {
+    Histogram& histogram = thread_metrics.get().latencies[latency];
+    bump(histogram.buckets[bucketOf(nanoseconds)], 1);
+    bump(histogram.count, 1);
+    bump(histogram.sum, nanoseconds);
+    if (nanoseconds > histogram.max.load(std::memory_order_relaxed)) {
+        histogram.max.store(nanoseconds, std::memory_order_relaxed);
+    }
+}
+
+void addGauge(const std::string& name, std::function<uint64_t()> read) {
+    addGauges({name}, [read = std::move(read)] { return std::vector<uint64_t>{read()}; });
+}
+
+void addGauges(const std::vector<std::string>& names, std::function<std::vector<uint64_t>()> read) {
+    std::lock_guard<std::mutex> guard(gauges_lock);
+    gauges.emplace_back(names, std::move(read));
+}
+
+std::string formatMetrics(std::string_view line_end) {
+    // Totals is large, keep it off the (possibly small) thread stack
+    std::unique_ptr<Totals> totals(new Totals());
+    {
+        std::lock_guard<std::mutex> guard(blocks_lock);
+        *totals = retired;
+        for (const MetricsBlock* block : blocks) {
+            totals->add(*block);
+        }
+    }
+
+    std::string report;
+    auto line = [&](const std::string& text) {
+        report += text;
+        report += line_end;
+    };
+
+    auto uptime = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - started);
+    line("uptime_s " + std::to_string(uptime.count()));
+    for (int i = 0; i < COUNTERS; i++) {
+        line(std::string(COUNTER_NAMES[i]) + " " + std::to_string(totals->counters[i]));
+    }
+    uint64_t active = totals->counters[COUNTER_CONNECTIONS] - totals->counters[COUNTER_DISCONNECTIONS];
+    line("connections_active " + std::to_string(active));
+    {
+        std::lock_guard<std::mutex> guard(gauges_lock);
+        for (const auto& gauge : gauges) {
+            std::vector<uint64_t> values = gauge.second();
+            for (size_t i = 0; i < gauge.first.size() && i < values.size(); i++) {
+                line(gauge.first[i] + " " + std::to_string(values[i]));
+            }
+        }
+    }
+
+    for (int l = 0; l < LATENCIES; l++) {
+        uint64_t count = totals->count[l];
+        uint64_t mean = count > 0 ? totals->sum[l] / count : 0;
+        line(std::string(LATENCY_NAMES[l]) + " count=" + std::to_string(count) +
+             " mean=" + std::to_string(mean) +
+             " p50=" + std::to_string(totals->percentile(l, 0.5)) +
+             " p90=" + std::to_string(totals->percentile(l, 0.9)) +
+             " p99=" + std::to_string(totals->percentile(l, 0.99)) +
+             " p999=" + std::to_string(totals->percentile(l, 0.999)) +
+             " max=" + std::to_string(totals->max[l]));
+    }
+    line("END");
+    return report;
+}
+
+void startMetricsDump(const std::string& path, unsigned period) {
+    std::thread(dumpLoop, path, std::max(period, 1u)).detach();
+}
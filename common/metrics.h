@@ -0,0 +1,94 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+
+/**
+ * Server metrics: event counters and per-command latency histograms. Every
+ * thread records into its own block with plain relaxed stores, so recording
+ * never contends with other threads; a snapshot sums the blocks of the
+ * running threads and the totals left by the ones that have exited.
+ *
+ * Histograms are log-bucketed like HdrHistogram: values below 16 ns have a
+ * bucket each, and every power of two above that is split into 16 linear
+ * sub-buckets, which keeps the relative error of a percentile under 1/16 for
+ * latencies up to about 36 minutes.
+ */
+
+enum Counter {
+    COUNTER_ADD,               // ADD commands and frames
+    COUNTER_DELIVER,           // DELIVER commands and frames
+    COUNTER_GEN,               // GEN keyboard commands
+    COUNTER_STATS,             // STATS commands
+    COUNTER_ERRORS,            // Commands that were rejected or failed
+    COUNTER_BYTES_IN,          // Bytes of commands received
+    COUNTER_BYTES_OUT,         // Bytes of responses sent
+    COUNTER_CONNECTIONS,       // TCP connections accepted
+    COUNTER_DISCONNECTIONS,    // TCP connections closed
+    COUNTERS
+};
+
+enum Latency { LATENCY_ADD, LATENCY_DELIVER, LATENCY_GEN, LATENCIES };
+
+/**
+ * Add n to a counter of the calling thread.
+ */
+void countEvent(Counter counter, uint64_t n = 1);
+
+/**
+ * Record one command latency in the calling thread's histogram.
+ */
+void recordLatency(Latency latency, uint64_t nanoseconds);
+
+/**
+ * Records the time from its construction to its destruction.
+ */
+class LatencyTimer {
+public:
+    explicit LatencyTimer(Latency latency) : latency_(latency), start_(std::chrono::steady_clock::now()) {}
+
+    ~LatencyTimer() {
+        auto elapsed = std::chrono::steady_clock::now() - start_;
+        recordLatency(latency_, std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+    }
+
+    LatencyTimer(const LatencyTimer&) = delete;
+    LatencyTimer& operator=(const LatencyTimer&) = delete;
+
+private:
+    Latency latency_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+/**
+ * Report the value read returns under name, after the counters. For state
+ * that is sampled rather than counted, such as a queue depth.
+ */
+void addGauge(const std::string& name, std::function<uint64_t()> read);
+
+/**
+ * Report several gauges that read returns together, in the order of names,
+ * so that related values come from one sample rather than one each.
+ */
+void addGauges(const std::vector<std::string>& names, std::function<std::vector<uint64_t>()> read);
+
+/**
+ * Text report of every counter, every gauge and the count, mean, p50, p90, p99, p99.9
+ * and maximum of every latency histogram (in ns), one metric per line and
+ * ending with an "END" line.
+ * @param line_end What terminates each line ("\r\n" on the network).
+ */
+std::string formatMetrics(std::string_view line_end = "\n");
+
+/**
+ * Rewrite path with a fresh report every period seconds, from a background
+ * thread. The file is replaced atomically, so readers never see half a report.
+ */
+void startMetricsDump(const std::string& path, unsigned period);
+
+#endif
@@ -0,0 +1,141 @@
+// Microbenchmark of the command parser: the istringstream/stoll parsing the
+// servers used before against the string_view tokenizer of commandParser.h.
+// Reports ns per command and heap allocations per command for each.
+//
+// Usage: parserBench [iterations]
+
+#include "commandParser.h"
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <map>
+#include <chrono>
+#include <cstdlib>
+#include <new>
+
+// Heap allocations made by the process, counted by the operator new below
+static unsigned long long allocations = 0;
+
+void* operator new(size_t size) {
+    allocations++;
+    void* p = malloc(size > 0 ? size : 1);
+    if (p == nullptr) throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+// The commands a busy server sees, as they arrive after framing
+static const std::string COMMANDS[] = {
+    "ADD CARBON 10",
+    "ADD OXYGEN 250",
+    "ADD HYDROGEN 4000",
+    "DELIVER WATER 3",
+    "DELIVER CARBON DIOXIDE 12",
+    "DELIVER SOFT DRINK",
+    "GEN CHAMPAGNE 2",
+    "ADD NEON 1",
+};
+static const size_t COMMAND_COUNT = sizeof(COMMANDS) / sizeof(COMMANDS[0]);
+
+static const std::map<std::string, int> LEGACY_MOLECULES = {
+    {"WATER", WATER}, {"CARBON DIOXIDE", CARBON_DIOXIDE}, {"GLUCOSE", GLUCOSE}, {"ALCOHOL", ALCOHOL},
+    {"SOFT DRINK", SOFT_DRINK}, {"VODKA", VODKA}, {"CHAMPAGNE", CHAMPAGNE}};
+
+// ADD parsing as processAtomCommand did it
+static bool legacyAdd(const std::string& command, int& atom, long long& count) {
+    std::istringstream iss(command);
+    std::string add, name;
+    if (!(iss >> add >> name >> count) || add != "ADD") return false;
+    if (name == "CARBON") atom = CARBON;
+    else if (name == "OXYGEN") atom = OXYGEN;
+    else if (name == "HYDROGEN") atom = HYDROGEN;
+    else return false;
+    return true;
+}
+
+// DELIVER/GEN parsing as processMoleculeCommand and processKeyboardCommand did it
+static bool legacyMolecule(const std::string& command, const std::string& verb, int& molecule, long long& count) {
+    std::istringstream iss(command);
+    std::string word;
+    if (!(iss >> word) || word != verb) return false;
+
+    std::string rest;
+    std::getline(iss, rest);
+    rest.erase(0, rest.find_first_not_of(" \t"));
+    rest.erase(rest.find_last_not_of(" \t") + 1);
+
+    size_t last_space = rest.find_last_of(" ");
+    std::string name;
+    count = 1;
+    if (last_space != std::string::npos && std::isdigit(rest[last_space + 1])) {
+        name = rest.substr(0, last_space);
+        count = std::stoll(rest.substr(last_space + 1));
+    } else {
+        name = rest;
+    }
+    auto it = LEGACY_MOLECULES.find(name);
+    if (it == LEGACY_MOLECULES.end()) return false;
+    molecule = it->second;
+    return true;
+}
+
+static long long parseLegacy(const std::string& command) {
+    int id;
+    long long count;
+    if (legacyAdd(command, id, count)) return id + count;
+    if (legacyMolecule(command, "DELIVER", id, count)) return id + count;
+    if (legacyMolecule(command, "GEN", id, count)) return id + count;
+    return -1;
+}
+
+static long long parseTokenized(std::string_view command) {
+    Atom atom;
+    MoleculeId molecule;
+    long long count;
+    if (parseAddCommand(command, atom, count)) return atom + count;
+    if (parseMoleculeCommand(command, "DELIVER", molecule, count) && molecule != MOLECULE_TYPES) return molecule + count;
+    if (parseMoleculeCommand(command, "GEN", molecule, count) && molecule != MOLECULE_TYPES) return molecule + count;
+    return -1;
+}
+
+// Run parse over the commands and print ns and allocations per command
+template <typename Parse>
+static long long run(const char* name, unsigned long iterations, Parse parse) {
+    long long checksum = 0;
+    unsigned long long before = allocations;
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned long i = 0; i < iterations; i++) {
+        checksum += parse(COMMANDS[i % COMMAND_COUNT]);
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    unsigned long long allocated = allocations - before;
+
+    double ns = std::chrono::duration<double, std::nano>(elapsed).count() / iterations;
+    std::cout << name << ": " << ns << " ns/op, " << (double)allocated / iterations << " allocations/op, "
+              << (unsigned long long)(1e9 / ns) << " ops/s" << std::endl;
+    return checksum;
+}
+
+int main(int argc, char* argv[]) {
+    unsigned long iterations = argc > 1 ? strtoul(argv[1], nullptr, 10) : 2000000;
+    if (iterations == 0) {
+        std::cerr << "Usage: " << argv[0] << " [iterations]" << std::endl;
+        return 1;
+    }
+
+    long long legacy = run("istringstream", iterations, [](const std::string& c) { return parseLegacy(c); });
+    long long tokenized = run("string_view  ", iterations, [](const std::string& c) { return parseTokenized(c); });
+    if (legacy != tokenized) {
+        std::cerr << "Parsers disagree: " << legacy << " != " << tokenized << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,167 @@
+#include "poolServer.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cerrno>
+#include <atomic>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+
+namespace {
+
+const int MAX_EVENTS = 256;               // Events handled per epoll_wait call
+const size_t OUTPUT_HIGH_WATER = 262144;  // Queued output that pauses reading from a client
+const int READS_PER_TASK = 16;            // Reads before a busy connection lets others have the worker
+
+std::atomic<unsigned long long> rejected(0);
+
+// A client connection, owned by whichever side holds it: the epoll set
+// while it is armed, a worker while its task runs
+struct Connection {
+    int fd;
+    std::string input;    // Bytes received after the last complete command
+    std::string output;   // Responses the socket has not taken yet
+    unsigned state = 0;   // Owned by the StreamHandler
+    bool closing = false; // Close once output is written
+};
+
+// What the tasks share with the loop that created them
+struct Server {
+    int epoll_fd;
+    const StreamHandler& handler;
+    const ConnectionObserver& observer;
+    std::atomic<unsigned> connections;
+};
+
+// Write as much queued output as the socket takes now; false on failure
+bool flushOutput(Connection* conn) {
+    size_t written = 0;
+    while (written < conn->output.size()) {
+        ssize_t n = send(conn->fd, conn->output.data() + written, conn->output.size() - written, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            return false;
+        }
+        written += n;
+    }
+    conn->output.erase(0, written);
+    return true;
+}
+
+// Task: write what is queued, read and handle what has arrived, then give
+// the connection back to the loop or close it
+void serveConnection(Server& server, Connection* conn) {
+    char buffer[16384];
+    bool failed = !flushOutput(conn);
+    for (int reads = 0; !failed && !conn->closing && conn->output.size() < OUTPUT_HIGH_WATER && reads < READS_PER_TASK;
+         reads++) {
+        ssize_t n = recv(conn->fd, buffer, sizeof(buffer), 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            failed = errno != EAGAIN && errno != EWOULDBLOCK;
+            break;
+        }
+        if (n == 0) {
+            conn->closing = true;  // Answer what came before the hang-up first
+            break;
+        }
+        conn->input.append(buffer, n);
+        if (!server.handler(conn->input, conn->output, conn->state)) conn->closing = true;
+        failed = !flushOutput(conn);
+    }
+
+    if (failed || (conn->closing && conn->output.empty())) {
+        close(conn->fd);  // Closing also removes it from the epoll set
+        delete conn;
+        server.connections.fetch_sub(1);
+        if (server.observer) server.observer(false);
+        return;
+    }
+
+    // Wait for input unless paused, and for room in the socket if output is left
+    struct epoll_event ev;
+    ev.events = EPOLLONESHOT;
+    if (!conn->closing && conn->output.size() < OUTPUT_HIGH_WATER) ev.events |= EPOLLIN;
+    if (!conn->output.empty()) ev.events |= EPOLLOUT;
+    ev.data.ptr = conn;
+    epoll_ctl(server.epoll_fd, EPOLL_CTL_MOD, conn->fd, &ev);
+}
+
+// Accept every pending connection, closing those over the cap
+void acceptConnections(Server& server, int listen_fd, unsigned max_connections) {
+    while (true) {
+        int fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) perror("accept");
+            return;
+        }
+        if (server.connections.load() >= max_connections) {
+            close(fd);
+            rejected.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+
+        Connection* conn = new Connection();
+        conn->fd = fd;
+        server.connections.fetch_add(1);
+        if (server.observer) server.observer(true);
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLONESHOT;
+        ev.data.ptr = conn;
+        if (epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            perror("epoll_ctl");
+            close(fd);
+            delete conn;
+            server.connections.fetch_sub(1);
+            if (server.observer) server.observer(false);
+        }
+    }
+}
+
+}  // namespace
+
+void runPoolServer(int listen_fd, WorkerPool& pool, const StreamHandler& handler, unsigned max_connections,
+                   const ConnectionObserver& observer) {
+    Server server{epoll_create1(EPOLL_CLOEXEC), handler, observer, {0}};
+    if (server.epoll_fd < 0) {
+        perror("epoll_create1");
+        exit(EXIT_FAILURE);
+    }
+    fcntl(listen_fd, F_SETFL, fcntl(listen_fd, F_GETFL, 0) | O_NONBLOCK);
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = nullptr;  // Clients carry their Connection, the listener nothing
+    if (epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev) < 0) {
+        perror("epoll_ctl");
+        exit(EXIT_FAILURE);
+    }
+
+    struct epoll_event events[MAX_EVENTS];
+    while (true) {
+        int ready = epoll_wait(server.epoll_fd, events, MAX_EVENTS, -1);
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            exit(EXIT_FAILURE);
+        }
+        for (int i = 0; i < ready; i++) {
+            Connection* conn = static_cast<Connection*>(events[i].data.ptr);
+            if (conn == nullptr) {
+                acceptConnections(server, listen_fd, max_connections);
+            }
+            else {
+                pool.submit([&server, conn] { serveConnection(server, conn); });
+            }
+        }
+    }
+}
+
+unsigned long long rejectedConnections() {
+    return rejected.load(std::memory_order_relaxed);
+}
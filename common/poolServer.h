@@ -0,0 +1,28 @@
+#ifndef POOL_SERVER_H
+#define POOL_SERVER_H
+
+#include "streamHandler.h"
+#include "workerPool.h"
+
+/**
+ * Serve the connections of a listening TCP socket with a worker pool: an
+ * epoll loop on the calling thread accepts connections and hands each one
+ * that has become readable (or writable again) to the pool as a task. A
+ * socket is re-armed only when its task is done (EPOLLONESHOT), so a
+ * connection is served by one worker at a time, in order, and queues at
+ * most one task. Output a client does not read is queued per connection,
+ * and the client is not read from while its queue is past a high-water mark.
+ * Does not return.
+ * @param max_connections Connections served at once; further ones are
+ *        accepted and closed right away.
+ * @param observer Optional, called for every connection opened and closed.
+ */
+void runPoolServer(int listen_fd, WorkerPool& pool, const StreamHandler& handler, unsigned max_connections,
+                   const ConnectionObserver& observer = nullptr);
+
+/**
+ * Connections closed on arrival because max_connections were open.
+ */
+unsigned long long rejectedConnections();
+
+#endif
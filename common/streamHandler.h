@@ -0,0 +1,21 @@
+#ifndef STREAM_HANDLER_H
+#define STREAM_HANDLER_H
+
+#include <string>
+#include <functional>
+
+/**
+ * Handles the bytes received on one connection: consumes the complete
+ * commands at the front of input and appends their responses to output.
+ * state belongs to the handler (e.g. the protocol the connection speaks)
+ * and is 0 for a new connection.
+ * @return False to close the connection once output has been sent.
+ */
+typedef std::function<bool(std::string& input, std::string& output, unsigned& state)> StreamHandler;
+
+/**
+ * Told when a connection is accepted (true) and when it is closed (false).
+ */
+typedef std::function<void(bool opened)> ConnectionObserver;
+
+#endif
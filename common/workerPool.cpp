@@ -0,0 +1,100 @@
+#include "workerPool.h"
+
+namespace {
+
+// The pool and queue of the calling worker thread, if it is one
+thread_local const void* current_pool = nullptr;
+thread_local unsigned current_queue = 0;
+
+}  // namespace
+
+WorkerPool::WorkerPool(unsigned workers) {
+    if (workers == 0) workers = std::thread::hardware_concurrency();
+    if (workers == 0) workers = 1;
+    for (unsigned i = 0; i < workers; i++) {
+        queues_.emplace_back(new Queue());
+    }
+    for (unsigned i = 0; i < workers; i++) {
+        threads_.emplace_back(&WorkerPool::run, this, i);
+    }
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> guard(idle_lock_);
+        stopping_ = true;
+    }
+    idle_.notify_all();
+    for (std::thread& thread : threads_) {
+        thread.join();
+    }
+}
+
+void WorkerPool::submit(Task task) {
+    unsigned index = current_pool == this ? current_queue
+                                          : next_queue_.fetch_add(1, std::memory_order_relaxed) % queues_.size();
+
+    // Counted before it is visible, so that queued_ never drops below zero
+    unsigned long long depth = queued_.fetch_add(1) + 1;
+    unsigned long long peak = peak_queued_.load(std::memory_order_relaxed);
+    while (depth > peak && !peak_queued_.compare_exchange_weak(peak, depth, std::memory_order_relaxed)) {
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(queues_[index]->lock);
+        queues_[index]->tasks.push_back(std::move(task));
+    }
+    {
+        std::lock_guard<std::mutex> guard(idle_lock_);  // A worker about to sleep sees the task
+    }
+    idle_.notify_one();
+}
+
+// Take the oldest task of the worker's own queue, or else steal the newest of another
+bool WorkerPool::take(unsigned index, Task& task) {
+    {
+        Queue& own = *queues_[index];
+        std::lock_guard<std::mutex> guard(own.lock);
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.front());
+            own.tasks.pop_front();
+            return true;
+        }
+    }
+    for (size_t i = 1; i < queues_.size(); i++) {
+        Queue& victim = *queues_[(index + i) % queues_.size()];
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.back());
+            victim.tasks.pop_back();
+            stolen_.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    return false;
+}
+
+void WorkerPool::run(unsigned index) {
+    current_pool = this;
+    current_queue = index;
+
+    while (true) {
+        Task task;
+        if (take(index, task)) {
+            queued_.fetch_sub(1);
+            task();
+            executed_.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+
+        // Sleep until a task is submitted; exit once stopping with nothing left
+        std::unique_lock<std::mutex> lock(idle_lock_);
+        idle_.wait(lock, [this] { return stopping_ || queued_.load() > 0; });
+        if (stopping_ && queued_.load() == 0) return;
+    }
+}
+
+WorkerPool::Stats WorkerPool::stats() const {
+    return {(unsigned)threads_.size(), queued_.load(), peak_queued_.load(std::memory_order_relaxed),
+            executed_.load(std::memory_order_relaxed), stolen_.load(std::memory_order_relaxed)};
+}
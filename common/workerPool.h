@@ -0,0 +1,76 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <functional>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+
+/**
+ * Fixed set of worker threads with one task queue each. A task submitted
+ * from a worker goes to that worker's queue, others are spread round-robin.
+ * A worker runs its own tasks in order and, when its queue is empty, steals
+ * the newest task of another worker before going to sleep, so a burst that
+ * lands on one queue is still spread over every core.
+ */
+class WorkerPool {
+public:
+    typedef std::function<void()> Task;
+
+    // Queue statistics, sampled without stopping the workers
+    struct Stats {
+        unsigned workers;
+        unsigned long long queued;       // Tasks waiting now
+        unsigned long long peak_queued;  // Most tasks ever waiting at once
+        unsigned long long executed;
+        unsigned long long stolen;       // Tasks run by a worker other than the one they were queued on
+    };
+
+    /**
+     * Start the workers.
+     * @param workers Number of threads, 0 for one per core.
+     */
+    explicit WorkerPool(unsigned workers = 0);
+
+    /**
+     * Run the tasks still queued, then stop the workers.
+     */
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    /**
+     * Queue a task; callable from any thread, including the workers.
+     */
+    void submit(Task task);
+
+    Stats stats() const;
+
+private:
+    struct Queue {
+        std::mutex lock;
+        std::deque<Task> tasks;
+    };
+
+    void run(unsigned index);
+    bool take(unsigned index, Task& task);
+
+    std::vector<std::unique_ptr<Queue>> queues_;
+    std::vector<std::thread> threads_;
+    std::atomic<unsigned> next_queue_{0};  // Round-robin target of outside submissions
+
+    std::mutex idle_lock_;
+    std::condition_variable idle_;
+    std::atomic<unsigned long long> queued_{0};
+    std::atomic<unsigned long long> peak_queued_{0};
+    std::atomic<unsigned long long> executed_{0};
+    std::atomic<unsigned long long> stolen_{0};
+    bool stopping_ = false;  // Guarded by idle_lock_
+};
+
+#endif